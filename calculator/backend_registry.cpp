@@ -0,0 +1,82 @@
+#include "backend_registry.h"
+
+namespace calc
+{
+
+void backend_registry::add( const std::string& name, std::unique_ptr< abstract_calc_handle_factory > factory )
+{
+    if( !factory )
+    {
+        throw std::invalid_argument{ "Invalid backend factory" };
+    }
+
+    auto& added = m_factories[ name ];
+    bool replaces_default{ added && added.get() == m_default };
+    added = std::move( factory );
+
+    if( !m_default || replaces_default )
+    {
+        m_default = added.get();
+        m_default_name = name;
+    }
+}
+
+void backend_registry::set_default( const std::string& name )
+{
+    m_default = &find( name );
+    m_default_name = name;
+}
+
+std::vector< std::string > backend_registry::names() const
+{
+    std::vector< std::string > result;
+    for( const auto& factory : m_factories )
+    {
+        result.push_back( factory.first );
+    }
+
+    return result;
+}
+
+std::unique_ptr< abstract_calc_handle > backend_registry::create() const
+{
+    if( !m_default )
+    {
+        throw std::logic_error{ "No backends registered" };
+    }
+
+    return m_default->create();
+}
+
+std::string backend_registry::calculate( const char* data, uint64_t size ) const
+{
+    if( !m_default )
+    {
+        throw std::logic_error{ "No backends registered" };
+    }
+
+    return m_default->calculate( data, size );
+}
+
+std::string backend_registry::default_backend() const
+{
+    return m_default_name;
+}
+
+std::unique_ptr< abstract_calc_handle > backend_registry::create_backend( const std::string& backend ) const
+{
+    return find( backend ).create();
+}
+
+const abstract_calc_handle_factory& backend_registry::find( const std::string& name ) const
+{
+    auto it = m_factories.find( name );
+    if( it == m_factories.end() )
+    {
+        throw std::invalid_argument{ "Unknown backend: " + name };
+    }
+
+    return *it->second;
+}
+
+} // calc
@@ -0,0 +1,38 @@
+#ifndef BACKEND_REGISTRY_H
+#define BACKEND_REGISTRY_H
+
+#include <map>
+#include <vector>
+
+#include "calc_handle_factory.h"
+
+namespace calc
+{
+
+// Factories of the handles of the different number types selectable by name.
+// The default one is used by the requests that don't name the type
+class backend_registry : public abstract_calc_handle_factory
+{
+public:
+    // The first added backend is the default one
+    void add( const std::string& name, std::unique_ptr< abstract_calc_handle_factory > factory );
+    void set_default( const std::string& name );
+    std::vector< std::string > names() const;
+
+    std::unique_ptr< abstract_calc_handle > create() const override;
+    std::unique_ptr< abstract_calc_handle > create_backend( const std::string& backend ) const override;
+    std::string default_backend() const override;
+    std::string calculate( const char* data, uint64_t size ) const override;
+
+private:
+    const abstract_calc_handle_factory& find( const std::string& name ) const;
+
+private:
+    std::map< std::string, std::unique_ptr< abstract_calc_handle_factory > > m_factories;
+    const abstract_calc_handle_factory* m_default{ nullptr };
+    std::string m_default_name;
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,184 @@
+#include "batch_calculator.h"
+
+#include <ios>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+
+#include <glob.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+
+namespace calc
+{
+
+void calculate_lines( const abstract_calc_handle_factory& factory, const char* data, uint64_t size,
+                      const std::function< void( std::string ) >& handler )
+{
+    const char* end{ data + size };
+
+    while( data != end )
+    {
+        const char* line_end{ std::find( data, end, '\n' ) };
+        if( line_end != data && *data != '\r' )
+        {
+            handler( factory.calculate( data, static_cast< uint64_t >( line_end - data ) ) );
+        }
+
+        data = line_end == end? end : line_end + 1;
+    }
+}
+
+uint64_t default_batch_memory() noexcept
+{
+    long pages{ ::sysconf( _SC_PHYS_PAGES ) };
+    long page_size{ ::sysconf( _SC_PAGESIZE ) };
+
+    return pages > 0 && page_size > 0? static_cast< uint64_t >( pages ) * static_cast< uint64_t >( page_size ) / 2 :
+                                       uint64_t{ 1 } << 30;
+}
+
+batch_calculator::batch_calculator( const abstract_calc_handle_factory& factory,
+                                    uint32_t threads_num,
+                                    uint64_t memory_limit ) :
+    m_factory( factory ),
+    m_threads_num( std::max< uint32_t >( threads_num, 1 ) ),
+    m_memory_limit( memory_limit ){}
+
+std::vector< std::string > batch_calculator::find_files( const std::string& pattern )
+{
+    std::vector< std::string > paths;
+
+    struct stat info;
+    if( ::stat( pattern.c_str(), &info ) == 0 && S_ISDIR( info.st_mode ) )
+    {
+        DIR* dir{ ::opendir( pattern.c_str() ) };
+        if( !dir )
+        {
+            throw std::ios_base::failure{ "Failed to open directory: " + pattern };
+        }
+
+        while( dirent* entry = ::readdir( dir ) )
+        {
+            paths.push_back( pattern + "/" + entry->d_name );
+        }
+
+        ::closedir( dir );
+    }
+    else
+    {
+        glob_t found;
+        if( ::glob( pattern.c_str(), 0, nullptr, &found ) == 0 )
+        {
+            paths.assign( found.gl_pathv, found.gl_pathv + found.gl_pathc );
+        }
+
+        ::globfree( &found );
+    }
+
+    paths.erase( std::remove_if( paths.begin(), paths.end(), []( const std::string& path )
+    {
+        struct stat info;
+        return ::stat( path.c_str(), &info ) != 0 || !S_ISREG( info.st_mode );
+    } ), paths.end() );
+
+    return paths;
+}
+
+void batch_calculator::calculate( const std::vector< std::string >& paths, std::ostream& out )
+{
+    // the biggest files take the longest, started first they don't end up alone at the end
+    std::vector< std::pair< uint64_t, std::string > > files;
+    for( const auto& path : paths )
+    {
+        struct stat info;
+        files.emplace_back( ::stat( path.c_str(), &info ) == 0? static_cast< uint64_t >( info.st_size ) : 0, path );
+    }
+
+    std::stable_sort( files.begin(), files.end(), []( const std::pair< uint64_t, std::string >& l,
+                                                      const std::pair< uint64_t, std::string >& r )
+    {
+        return l.first > r.first;
+    } );
+
+    std::size_t next{ 0 };
+    uint64_t memory_used{ 0 };
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    auto work = [ & ]()
+    {
+        std::unique_lock< std::mutex > l{ mutex };
+
+        while( true )
+        {
+            // a file bigger than the limit is calculated alone
+            cv.wait( l, [ & ]()
+            {
+                return next == files.size() || !memory_used || memory_used + files[ next ].first <= m_memory_limit;
+            } );
+
+            if( next == files.size() )
+            {
+                return;
+            }
+
+            const auto& file = files[ next++ ];
+            memory_used += file.first;
+            l.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            std::string results{ calculate_file( file.second ) };
+            auto finish = std::chrono::steady_clock::now();
+            uint64_t msec = std::chrono::duration_cast< std::chrono::milliseconds >( finish - start ).count();
+
+            l.lock();
+            memory_used -= file.first;
+            cv.notify_all();
+
+            out << file.second << '\t' << file.first << '\t' << msec << '\t' << results << std::endl;
+        }
+    };
+
+    std::vector< std::thread > workers;
+    for( uint32_t i{ 0 }; i < std::min< std::size_t >( m_threads_num, files.size() ); ++i )
+    {
+        workers.emplace_back( work );
+    }
+
+    for( auto& worker : workers )
+    {
+        worker.join();
+    }
+}
+
+std::string batch_calculator::calculate_file( const std::string& path ) const
+{
+    std::string results;
+
+    try
+    {
+        mapped_file file{ path };
+        calculate_lines( m_factory, file.data(), file.size(), [ &results ]( std::string result )
+        {
+            if( !results.empty() )
+            {
+                results += ' ';
+            }
+
+            results += result;
+        } );
+    }
+    catch( const std::exception& e )
+    {
+        results = e.what();
+    }
+
+    return results;
+}
+
+} // calc
@@ -0,0 +1,49 @@
+#ifndef BATCH_CALCULATOR_H
+#define BATCH_CALCULATOR_H
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <ostream>
+#include <functional>
+
+#include "calc_handle_factory.h"
+
+namespace calc
+{
+
+// Calculates every non-empty line of the text in place with the factory, the handler gets the results in order
+void calculate_lines( const abstract_calc_handle_factory& factory, const char* data, uint64_t size,
+                      const std::function< void( std::string ) >& handler );
+
+// Half of the physical memory
+uint64_t default_batch_memory() noexcept;
+
+// Calculates many expression files on a pool of threads, the biggest ones first. The files calculated
+// at once are limited by their total size as well, so a few huge files don't run out of memory together.
+// As each file is done a tab separated line is written: the path, the size, the milliseconds spent
+// and the results of its lines separated by spaces
+class batch_calculator
+{
+public:
+    batch_calculator( const abstract_calc_handle_factory& factory,
+                      uint32_t threads_num = std::thread::hardware_concurrency(),
+                      uint64_t memory_limit = default_batch_memory() );
+
+    // The regular files of the directory or the ones matching the glob pattern
+    static std::vector< std::string > find_files( const std::string& pattern );
+
+    void calculate( const std::vector< std::string >& paths, std::ostream& out );
+
+private:
+    std::string calculate_file( const std::string& path ) const;
+
+private:
+    const abstract_calc_handle_factory& m_factory;
+    uint32_t m_threads_num{ 1 };
+    uint64_t m_memory_limit{ 0 };
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef BIG_INTEGER_TRAITS_H
+#define BIG_INTEGER_TRAITS_H
+
+#include "calculator.h"
+
+#include "big_int/BigIntegerUtils.hh"
+
+namespace calc
+{
+
+namespace detail
+{
+
+// The own conversion of BigInteger, its time grows with the square of the number of digits
+struct big_integer_leaf_traits
+{
+    static std::string format( const BigInteger& value )
+    {
+        return bigIntegerToString( value );
+    }
+};
+
+}// detail
+
+template<>
+struct progressive_format< BigInteger >
+{
+    static void format( const BigInteger& value, const std::function< void( std::string ) >& handler )
+    {
+        detail::halving_formatter< BigInteger, detail::big_integer_leaf_traits >{ handler }.format( value );
+    }
+};
+
+// The own conversion takes minutes for tens of thousands of digits, the halves are converted instead
+template<>
+struct number_traits< BigInteger >
+{
+    static BigInteger parse( const std::string& str )
+    {
+        return boost::lexical_cast< BigInteger >( str );
+    }
+
+    static std::string format( const BigInteger& value )
+    {
+        std::string result;
+        progressive_format< BigInteger >::format( value, [ &result ]( std::string chunk ){ result += chunk; } );
+
+        return result;
+    }
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,161 @@
+#include "bracket_index.h"
+
+#include <algorithm>
+
+namespace calc
+{
+
+namespace
+{
+
+struct chunk
+{
+    chunk( const char* b, const char* e ) : begin( b ), end( e ){}
+
+    const char* begin;
+    const char* end;
+
+    // filled by the first pass
+    int64_t depth_change{ 0 };
+    int64_t min_depth{ 0 };
+
+    // filled by the second pass, offsets of the brackets left unmatched in the chunk
+    std::vector< std::size_t > open_closings;
+    std::vector< std::size_t > open_openings;
+    std::vector< std::pair< std::size_t, std::size_t > > groups;
+};
+
+}
+
+bracket_index::bracket_index( const char* begin, const char* end, std::size_t min_group_size,
+                              executor& exec, std::size_t chunk_size ) :
+    m_begin( begin ),
+    m_end( end )
+{
+    std::size_t size( end - begin );
+    chunk_size = std::max< std::size_t >( chunk_size, 1 );
+
+    std::vector< chunk > chunks;
+    for( std::size_t offset{ 0 }; offset < size; offset += chunk_size )
+    {
+        chunks.emplace_back( begin + offset, begin + std::min( size, offset + chunk_size ) );
+    }
+
+    exec.run_parallel( chunks.size(), [ & ]( std::size_t i )
+    {
+        chunk& c( chunks[ i ] );
+        int64_t depth{ 0 };
+
+        for( const char* it{ c.begin }; it != c.end; ++it )
+        {
+            if( *it == '(' )
+            {
+                ++depth;
+            }
+            else if( *it == ')' )
+            {
+                c.min_depth = std::min( c.min_depth, --depth );
+            }
+        }
+
+        c.depth_change = depth;
+    } );
+
+    // the prefix sum of the depth changes is the depth at the start of each chunk
+    int64_t depth{ 0 };
+    for( const auto& c : chunks )
+    {
+        if( depth + c.min_depth < 0 )
+        {
+            return;
+        }
+
+        depth += c.depth_change;
+    }
+
+    if( depth )
+    {
+        return;
+    }
+
+    exec.run_parallel( chunks.size(), [ & ]( std::size_t i )
+    {
+        chunk& c( chunks[ i ] );
+
+        for( const char* it{ c.begin }; it != c.end; ++it )
+        {
+            std::size_t offset( it - begin );
+
+            if( *it == '(' )
+            {
+                c.open_openings.push_back( offset );
+            }
+            else if( *it == ')' )
+            {
+                if( c.open_openings.empty() )
+                {
+                    c.open_closings.push_back( offset );
+                }
+                else
+                {
+                    if( offset - c.open_openings.back() >= min_group_size )
+                    {
+                        c.groups.emplace_back( c.open_openings.back(), offset );
+                    }
+
+                    c.open_openings.pop_back();
+                }
+            }
+        }
+    } );
+
+    // the brackets left open in the chunks are matched in the order of the chunks
+    std::vector< std::size_t > openings;
+    for( auto& c : chunks )
+    {
+        for( std::size_t closing : c.open_closings )
+        {
+            if( closing - openings.back() >= min_group_size )
+            {
+                m_groups.emplace_back( openings.back(), closing );
+            }
+
+            openings.pop_back();
+        }
+
+        openings.insert( openings.end(), c.open_openings.begin(), c.open_openings.end() );
+        m_groups.insert( m_groups.end(), c.groups.begin(), c.groups.end() );
+    }
+
+    std::sort( m_groups.begin(), m_groups.end() );
+    m_valid = true;
+}
+
+const char* bracket_index::closing( const char* opening ) const noexcept
+{
+    std::size_t offset( opening - m_begin );
+    auto it = std::lower_bound( m_groups.begin(), m_groups.end(), std::make_pair( offset, std::size_t{ 0 } ) );
+
+    if( it != m_groups.end() && it->first == offset )
+    {
+        return m_begin + it->second;
+    }
+
+    // small group, stepped over
+    int depth{ 0 };
+    for( const char* pos{ opening }; pos != m_end; ++pos )
+    {
+        if( *pos == '(' )
+        {
+            ++depth;
+        }
+        else if( *pos == ')' && !--depth )
+        {
+            return pos;
+        }
+    }
+
+    return m_end;
+}
+
+} // calc
@@ -0,0 +1,43 @@
+#ifndef BRACKET_INDEX_H
+#define BRACKET_INDEX_H
+
+#include <vector>
+#include <utility>
+
+#include "executor.h"
+
+namespace calc
+{
+
+// Index of the brackets of a buffered expression built by the workers of the executor.
+// The text is cut into chunks, the bracket depth at the start of each chunk is the prefix
+// sum of the depth changes of the previous ones, then the chunks match their brackets
+// concurrently and the brackets left open are matched across the chunks.
+// Only the groups of at least min_group_size bytes are kept: the smaller ones are cheaper
+// to step over than to look up
+class bracket_index
+{
+public:
+    static constexpr std::size_t default_chunk_size{ 1 << 22 };
+
+    bracket_index( const char* begin, const char* end, std::size_t min_group_size,
+                   executor& exec = executor::instance(), std::size_t chunk_size = default_chunk_size );
+
+    // Whether the brackets of the whole text are balanced
+    bool valid() const noexcept{ return m_valid; }
+
+    // The closing bracket of the group opened at the position
+    const char* closing( const char* opening ) const noexcept;
+
+private:
+    const char* m_begin{ nullptr };
+    const char* m_end{ nullptr };
+    bool m_valid{ false };
+
+    // offsets of the opening and closing brackets of the big groups, sorted by the opening ones
+    std::vector< std::pair< std::size_t, std::size_t > > m_groups;
+};
+
+} // calc
+
+#endif
@@ -7,11 +7,20 @@
     #include "logger.h"
 #endif
 
-#include <boost/lexical_cast.hpp>
+#include <functional>
 
 namespace calc
 {
 
+using result_handler = std::function< void( std::string ) >;
+
+// Gets the parts of the result, the most significant digits first, and an empty last one
+using chunk_handler = std::function< void( std::string, bool last ) >;
+
+// Expressions up to this size that arrive in one piece are evaluated
+// right on the calling(io) thread
+static constexpr uint64_t default_inline_limit{ 1024 };
+
 // Used to provide type independent interface for session-calculator interraction
 class abstract_calc_handle
 {
@@ -25,50 +34,289 @@ public:
     virtual void reset() = 0;
     virtual void abort() = 0;
     virtual std::string get_result() = 0;
+
+    // Non-blocking alternative to get_result(): the handler gets the formatted result
+    // on the compute thread that has finished the calculation(or right away if it's done)
+    virtual void async_get_result( result_handler handler ) = 0;
+
+    // Like async_get_result(), but a huge result may be passed in chunks while the rest of it
+    // is still being converted. By default the whole result comes as the last chunk
+    virtual void async_get_result_chunks( chunk_handler handler )
+    {
+        assert( handler );
+
+        async_get_result( [ handler ]( std::string result ){ handler( std::move( result ), true ); } );
+    }
+
+    // The data waiting to be calculated is counted by the limiter, shouldn't be called while running
+    virtual void set_ingest_limiter( ingest_limiter* limiter ) = 0;
 };
 
 template< typename type >
 class calc_handle : public abstract_calc_handle
 {
 public:
+    explicit calc_handle( uint64_t inline_limit = default_inline_limit, std::size_t memo_limit = 0 ) :
+        m_inline_limit( inline_limit ),
+        m_calculator( executor::instance(), memo_limit )
+    {
+        m_calculator.set_completion_handler( std::bind( &calc_handle::on_calculation_done, this ) );
+    }
+
     void on_data( const char* data, uint64_t size, bool end = false ) override
     {
         assert( data );
 
-        std::string new_data{ data, size };
-        if( end && new_data.back() != '\n' )
+        if( !m_started && end && size <= m_inline_limit )
         {
-            new_data += "\n"; // just in case to avoid unnecessary hanging
+            calculate_inline( data, size );
+            return;
         }
 
-        if( m_calculator.running() )
+        // nothing to start the calculation with yet
+        if( !size && !end )
         {
-            m_calculator.add_expr_part( std::move( new_data ) );
+            return;
         }
-        else
+
+        std::string new_data{ data, size };
+        if( end && ( new_data.empty() || new_data.back() != '\n' ) )
+        {
+            new_data += "\n"; // just in case to avoid unnecessary hanging
+        }
+
+        if( !m_started )
         {
+            // the completion handler waits for the future to be stored
+            std::lock_guard< std::mutex > l{ m_mutex };
 #ifdef SHOW_TIME
             m_start = std::chrono::high_resolution_clock::now();
 #endif
+            m_started = true;
+            m_result_ready = false;
+            m_formatted_result.clear();
             m_result = m_calculator.start( std::move( new_data ) );
         }
+        else if( m_calculator.running() )
+        {
+            try
+            {
+                m_calculator.add_expr_part( std::move( new_data ) );
+            }
+            catch( const std::logic_error& )
+            {
+                // the calculation has failed in the meantime, the rest of the expression is dropped
+            }
+        }
     }
 
+    // The end of the expression started by on_data() is taken from the file without copying it
+    void on_spilled_data( std::unique_ptr< spill_file > spill )
+    {
+        assert( spill && m_started );
+
+        try
+        {
+            m_calculator.add_spilled_parts( std::move( spill ) );
+        }
+        catch( const std::logic_error& )
+        {
+            // the calculation has failed in the meantime, the rest of the expression is dropped
+        }
+    }
+
+    void set_ingest_limiter( ingest_limiter* limiter ) override
+    {
+        m_calculator.set_ingest_limiter( limiter );
+    }
+
+    // Whether the calculation has failed because the numbers didn't fit the type
+    bool overflowed() const noexcept{ return m_overflowed; }
+
     bool running() const noexcept override{ return m_calculator.running(); }
-    bool finished() const noexcept override{ return m_calculator.finished(); }
-    bool error_occured() const noexcept override{ return m_calculator.error_occured(); }
+    bool finished() const noexcept override{ return m_inline_finished || m_calculator.finished(); }
+    bool error_occured() const noexcept override{ return m_inline_error_occured || m_calculator.error_occured(); }
     void abort() override{ return m_calculator.abort(); }
-    void reset() override{ return m_calculator.reset(); }
+    void reset() override
+    {
+        m_calculator.reset();
+
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_started = false;
+        m_inline_finished = false;
+        m_inline_error_occured = false;
+        m_overflowed = false;
+        m_result_ready = false;
+        m_formatted_result.clear();
+        m_result_handler = nullptr;
+        m_chunk_handler = nullptr;
+    }
 
     std::string get_result() override
     {
-        std::string result{ "No calculation was done" };
+        std::unique_lock< std::mutex > l{ m_mutex };
+        if( !m_started )
+        {
+            return no_result();
+        }
+
+        m_cv.wait( l, [ this ](){ return m_result_ready; } );
+        return m_formatted_result;
+    }
+
+    void async_get_result( result_handler handler ) override
+    {
+        assert( handler );
+
+        std::unique_lock< std::mutex > l{ m_mutex };
+        if( !m_started || m_result_ready )
+        {
+            std::string result{ m_started? m_formatted_result : no_result() };
+            l.unlock();
+
+            handler( std::move( result ) );
+        }
+        else
+        {
+            m_result_handler = std::move( handler );
+        }
+    }
+
+    // The chunks are passed if the handler is set before the conversion of the result starts,
+    // the streamed result isn't kept for get_result()
+    void async_get_result_chunks( chunk_handler handler ) override
+    {
+        assert( handler );
+
+        std::unique_lock< std::mutex > l{ m_mutex };
+        if( !m_started || m_result_ready )
+        {
+            std::string result{ m_started? m_formatted_result : no_result() };
+            l.unlock();
+
+            handler( std::move( result ), true );
+        }
+        else
+        {
+            m_chunk_handler = std::move( handler );
+        }
+    }
+
+private:
+    static std::string no_result()
+    {
+        return "No calculation was done";
+    }
+
+    // Reported by get_result() instead of the text that was only passed to the chunk handler
+    static std::string streamed_result()
+    {
+        return "The result was passed in chunks";
+    }
+
+    // Fast path for the small requests: no executor round trip and no waiting,
+    // the calculator is idle, so nothing else touches the state
+    void calculate_inline( const char* data, uint64_t size )
+    {
+        try
+        {
+            expression_evaluator< type > evaluator;
+            if( evaluator.consume( data, size ) == size && !evaluator.finished() )
+            {
+                evaluator.consume( "\n", 1 ); // just in case to avoid unnecessary hanging
+            }
+
+            m_formatted_result = number_traits< type >::format( evaluator.result() );
+        }
+        catch( const calc::calculation_overflow& e )
+        {
+            m_formatted_result = e.what();
+            m_inline_error_occured = true;
+            m_overflowed = true;
+        }
+        catch( const std::exception& e )
+        {
+            m_formatted_result = e.what();
+            m_inline_error_occured = true;
+        }
+
+        m_started = true;
+        m_inline_finished = true;
+        m_result_ready = true;
+    }
+
+    // Called by the calculator on the compute thread
+    void on_calculation_done()
+    {
+        std::future< type > result_future;
+        chunk_handler chunks;
+
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            result_future = std::move( m_result );
+            chunks = std::move( m_chunk_handler );
+            m_chunk_handler = nullptr;
+        }
+
+        // the conversion may take long for huge numbers, keep the io threads unlocked
+        bool streamed{ false };
+        std::string result{ format_result( result_future, chunks, streamed ) };
+        result_handler handler;
+
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            m_formatted_result = streamed? streamed_result() : result;
+            m_result_ready = true;
+            handler = std::move( m_result_handler );
+            m_result_handler = nullptr;
+
+            // set while the result was being converted
+            if( !chunks )
+            {
+                chunks = std::move( m_chunk_handler );
+                m_chunk_handler = nullptr;
+            }
+
+            // the handle may be destroyed right after the lock is released
+            m_cv.notify_all();
+        }
+
+        if( handler )
+        {
+            handler( std::move( result ) );
+        }
+        else if( chunks )
+        {
+            chunks( streamed? std::string{} : std::move( result ), true );
+        }
+    }
+
+    // The chunks of the converted number are passed to the handler if it's set, streamed tells
+    // whether any were. Then the text isn't kept and an empty string is returned. The errors are only returned
+    std::string format_result( std::future< type >& result_future, const chunk_handler& chunks, bool& streamed )
+    {
+        std::string result{ no_result() };
 
         try
         {
-            if( m_result.valid() )
+            if( result_future.valid() )
             {
-                result = boost::lexical_cast< std::string >( m_result.get() );
+                type value{ result_future.get() };
+
+                if( chunks )
+                {
+                    progressive_format< type >::format( value, [ &chunks, &streamed ]( std::string chunk )
+                    {
+                        streamed = true;
+                        chunks( std::move( chunk ), false );
+                    } );
+
+                    result.clear();
+                }
+                else
+                {
+                    result = number_traits< type >::format( value );
+                }
 #ifdef SHOW_TIME
                 auto end = std::chrono::high_resolution_clock::now();
                 uint64_t msec = std::chrono::duration_cast< std::chrono::milliseconds >( end - m_start ).count();
@@ -80,6 +328,11 @@ public:
         {
             result = "Calculation aborted";
         }
+        catch( const calc::calculation_overflow& e )
+        {
+            result = e.what();
+            m_overflowed = true;
+        }
         catch( const std::exception& e )
         {
             result = e.what();
@@ -89,12 +342,28 @@ public:
     }
 
 private:
-    calc::async_calculator< type > m_calculator;
     std::future< type > m_result;
 
+    uint64_t m_inline_limit{ default_inline_limit };
+    bool m_inline_finished{ false };
+    bool m_inline_error_occured{ false };
+    bool m_overflowed{ false };
+
+    bool m_started{ false };
+    bool m_result_ready{ false };
+    std::string m_formatted_result;
+    result_handler m_result_handler;
+    chunk_handler m_chunk_handler;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
 #ifdef SHOW_TIME
     std::chrono::high_resolution_clock::time_point m_start;
 #endif
+
+    // destroyed first: waits for the completion handler that uses the members above
+    calc::async_calculator< type > m_calculator;
 };
 
 } // calc
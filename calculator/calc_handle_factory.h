@@ -4,6 +4,8 @@
 #include <unordered_map>
 
 #include "calc_handle.h"
+#include "fallback_calc_handle.h"
+#include "parallel_calculator.h"
 
 namespace std
 {
@@ -19,21 +21,108 @@ std::unique_ptr< type > make_unique( ctor_args&&... args )
 namespace calc
 {
 
+// Formatted result of the expression that is already in memory or the error message.
+// The big expressions are split between the threads of the executor
+template< typename type >
+std::string calculate_in_memory( const char* data, uint64_t size, bool* overflowed = nullptr )
+{
+    try
+    {
+        parallel_calculator< type > calculator;
+        return number_traits< type >::format( calculator.calculate( data, size ) );
+    }
+    catch( const calc::calculation_overflow& e )
+    {
+        if( overflowed )
+        {
+            *overflowed = true;
+        }
+
+        return e.what();
+    }
+    catch( const std::exception& e )
+    {
+        return e.what();
+    }
+}
+
 class abstract_calc_handle_factory
 {
 public:
     virtual ~abstract_calc_handle_factory() = default;
     virtual std::unique_ptr< abstract_calc_handle > create() const = 0;
+
+    // Handle of the number type requested by name, the factories of a single type know no names
+    virtual std::unique_ptr< abstract_calc_handle > create_backend( const std::string& backend ) const
+    {
+        throw std::invalid_argument{ "Unknown backend: " + backend };
+    }
+
+    // Name of the number type of create(), the same text gives different results with the different ones
+    virtual std::string default_backend() const
+    {
+        return {};
+    }
+
+    // Calculates the expression that is already in memory(e.g. a mapped file) without copying it,
+    // the calling thread waits for the result. Up to the first newline, like the handles
+    virtual std::string calculate( const char* data, uint64_t size ) const
+    {
+        std::unique_ptr< abstract_calc_handle > handle{ create() };
+        handle->on_data( data, size, true );
+
+        return handle->get_result();
+    }
 };
 
 template < typename type >
 class calc_handle_factory : public abstract_calc_handle_factory
 {
 public:
+    explicit calc_handle_factory( uint64_t inline_limit = default_inline_limit, std::size_t memo_limit = 0 ) noexcept :
+        m_inline_limit( inline_limit ),
+        m_memo_limit( memo_limit ){}
+
     std::unique_ptr< abstract_calc_handle > create() const override
     {
-        return std::make_unique< calc_handle< type > >();
+        return std::make_unique< calc_handle< type > >( m_inline_limit, m_memo_limit );
+    }
+
+    std::string calculate( const char* data, uint64_t size ) const override
+    {
+        return calculate_in_memory< type >( data, size );
     }
+
+private:
+    uint64_t m_inline_limit{ default_inline_limit };
+    std::size_t m_memo_limit{ 0 };
+};
+
+template < typename fast_type, typename exact_type >
+class fallback_calc_handle_factory : public abstract_calc_handle_factory
+{
+public:
+    explicit fallback_calc_handle_factory( uint64_t inline_limit = default_inline_limit, std::size_t memo_limit = 0 ) noexcept :
+        m_inline_limit( inline_limit ),
+        m_memo_limit( memo_limit ){}
+
+    std::unique_ptr< abstract_calc_handle > create() const override
+    {
+        return std::make_unique< fallback_calc_handle< fast_type, exact_type > >( m_inline_limit, m_memo_limit );
+    }
+
+    // the text stays in memory, so the retry needs no buffering
+    std::string calculate( const char* data, uint64_t size ) const override
+    {
+        bool overflowed{ false };
+        std::string result{ calculate_in_memory< fast_type >( data, size, &overflowed ) };
+
+        return overflowed? calculate_in_memory< exact_type >( data, size ) : result;
+    }
+
+private:
+    uint64_t m_inline_limit{ default_inline_limit };
+    std::size_t m_memo_limit{ 0 };
 };
 
 } // calc
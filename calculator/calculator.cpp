@@ -50,6 +50,15 @@ operator_type get_oper_type( char c )
     return type;
 }
 
+bool continues_run( const operator_type& top, const operator_type& oper ) noexcept
+{
+    bool additive_top{ top == operator_type::addition || top == operator_type::substraction };
+    bool additive_oper{ oper == operator_type::addition || oper == operator_type::substraction };
+
+    return ( additive_top && additive_oper ) ||
+           ( top == operator_type::multiplication && oper == operator_type::multiplication );
+}
+
 entry_type get_entry_type( char c )
 {
     entry_type type;
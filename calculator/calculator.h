@@ -2,11 +2,20 @@
 #define CALCULATOR_H
 
 #include <stack>
-#include <queue>
+#include <memory>
+#include <deque>
+#include <vector>
 #include <future>
+#include <algorithm>
+#include <functional>
 
 #include <boost/lexical_cast.hpp>
 
+#include "executor.h"
+#include "ingest_limiter.h"
+#include "spill_file.h"
+#include "subexpression_memo.h"
+
 namespace calc
 {
 
@@ -21,218 +30,534 @@ enum class entry_type{ number, math, opening_bracket, closing_bracket, expr_end
 // to know when it's possible to unwind the stack
 enum class operator_type{ subexpr_start, subexpr_first_num, end, addition, substraction, multiplication, division, };
 
+// operand_expected: after the start of the expression, '(' or a math operator
+// number: in the middle of a number, the digits are accumulated until the first non-digit
+// operator_expected: after a number or ')'
+enum class parse_state{ operand_expected, number, operator_expected, finished };
+
 int get_precedence( const operator_type& type ) noexcept;
 operator_type get_oper_type( char c );
 entry_type get_entry_type( char c );
 
+// Whether the operator continues the run of the top one: runs of multiplications
+// and of additions/substractions are reduced as balanced trees instead of left to right
+bool continues_run( const operator_type& top, const operator_type& oper ) noexcept;
+
+// Number on the stack, rank is the height of the reduction tree it is the result of,
+// only the operands of the same rank are merged while the run goes on.
+// zero_product tells whether the multiplication run up to this operand is zero
+template< typename type >
+struct operand
+{
+    operand( type v, uint32_t r ) : value( std::move( v ) ), rank( r ){}
+
+    type value;
+    uint32_t rank;
+    bool zero_product{ false };
+};
+
 }// detail
 
 class calculation_aborted : public std::exception{};
 
-template < typename type >
-class async_calculator
+// Conversions between the numbers and the text, specialized for
+// the types that have faster ones than the streams
+template< typename type >
+struct number_traits
 {
-public:
-    // Start new calculation
-    std::future< type > start( const std::string& expr_beginning )
+    static type parse( const std::string& str )
     {
-        return start_impl( expr_beginning );
+        return boost::lexical_cast< type >( str );
     }
 
-    std::future< type > start( std::string&& expr_beginning )
+    static std::string format( const type& value )
     {
-        return start_impl( std::move( expr_beginning ) );
+        return boost::lexical_cast< std::string >( value );
     }
+};
 
-    // Add more data to the current calculation
-    void add_expr_part( const std::string& expr_part )
+// Writes the decimal text of the value as a series of chunks, the most significant digits first,
+// so the beginning of a huge result may be sent while the rest is being converted.
+// Specialized for the types that have a way to produce the leading digits early
+template< typename type >
+struct progressive_format
+{
+    static void format( const type& value, const std::function< void( std::string ) >& handler )
     {
-       add_expr_part_impl( expr_part );
+        handler( number_traits< type >::format( value ) );
     }
+};
 
-    void add_expr_part( std::string&& expr_part )
-    {
-       add_expr_part_impl( std::move( expr_part ) );
-    }
+namespace detail
+{
 
-    void abort()
+// Digits converted at once by number_traits, the bigger values are split by the powers of 10
+static constexpr std::size_t format_leaf_digits{ 512 };
+
+// Text passed to the handler at once
+static constexpr std::size_t format_chunk_size{ 1 << 20 };
+
+// Divide and conquer conversion of an arbitrary precision integer: the value below 10^( leaf * 2^level )
+// is split by 10^( leaf * 2^( level - 1 ) ) and the high half is written first, so the leading chunk
+// is ready after the divisions along the leftmost path. type should be constructible from int64_t,
+// leaf_traits::format() converts the values below 10^leaf
+template< typename type, typename leaf_traits = number_traits< type > >
+class halving_formatter
+{
+public:
+    explicit halving_formatter( const std::function< void( std::string ) >& handler,
+                                std::size_t leaf_digits = format_leaf_digits ) :
+        m_handler( handler ),
+        m_leaf_digits( std::max< std::size_t >( leaf_digits, 1 ) ){}
+
+    void format( type value )
     {
-        std::lock_guard< std::mutex > l{ m_mutex };
-        if( m_running )
+        if( value < type( int64_t{ 0 } ) )
         {
-            m_running = false;
-            m_cv.notify_one();
+            m_chunk += '-';
+            value = type( int64_t{ 0 } ) - value;
         }
-    }
 
-    void reset()
-    {
-        std::lock_guard< std::mutex > l{ m_mutex };
-        if( m_running )
+        m_powers.push_back( power_of_ten( m_leaf_digits ) );
+        while( !( value < m_powers.back() ) )
         {
-            throw std::logic_error{ "Calculation is running" };
+            m_powers.push_back( m_powers.back() * m_powers.back() );
         }
 
-        clean_all();
+        write( value, m_powers.size() - 1, false );
+        m_handler( std::move( m_chunk ) );
     }
 
-    bool running() const noexcept{ return m_running; }
-    bool finished() const noexcept{ return m_calculation_finished; }
-    bool error_occured() const noexcept{ return m_error_occured; }
-
 private:
-    template< typename string_type >
-    std::future< type > start_impl( string_type&& expr_beginning )
+    static type power_of_ten( std::size_t exponent )
     {
-        if( expr_beginning.empty() )
-        {
-            throw std::invalid_argument{ "Empty expression" };
-        }
+        type result( int64_t{ 1 } );
+        type square( int64_t{ 10 } );
 
-        std::lock_guard< std::mutex > l{ m_mutex };
-        if( !m_running )
+        for( ; exponent; exponent >>= 1 )
         {
-            clean_all();
-
-            m_running = true;
+            if( exponent & 1 )
+            {
+                result *= square;
+            }
 
-            m_expression_parts.push( std::forward< string_type >( expr_beginning ) );
-            return std::async( std::launch::async,
-                               &async_calculator< type >::calculate, this );
-        }
-        else
-        {
-            throw std::logic_error{ "Another calculation is in progress" };
+            if( exponent > 1 )
+            {
+                square = square * square;
+            }
         }
+
+        return result;
     }
 
-    template< typename string_type >
-    void add_expr_part_impl( string_type&& expr_part )
+    // The padded values are written with all the leading zeroes of their level
+    void write( const type& value, std::size_t level, bool padded )
     {
-        if( expr_part.empty() )
+        if( !level )
         {
-            throw std::invalid_argument{ "Empty expression" };
-        }
+            std::string digits{ leaf_traits::format( value ) };
+            if( padded )
+            {
+                m_chunk.append( m_leaf_digits - digits.length(), '0' );
+            }
 
-        std::lock_guard< std::mutex > l{ m_mutex };
-        if( m_running )
-        {
-            m_expression_parts.push( std::forward< string_type >( expr_part ) );
-            m_cv.notify_one();
+            m_chunk += digits;
+            if( m_chunk.length() >= format_chunk_size )
+            {
+                m_handler( std::move( m_chunk ) );
+                m_chunk = std::string{};
+            }
+
+            return;
         }
-        else
+
+        const type& power = m_powers[ level - 1 ];
+        if( !padded && value < power )
         {
-            throw std::logic_error{ "Calculation is not running" };
+            write( value, level - 1, false );
+            return;
         }
+
+        type high{ value / power };
+        type low{ value - high * power };
+        write( high, level - 1, padded );
+        write( low, level - 1, true );
     }
 
-    void clean_parse_data()
+private:
+    const std::function< void( std::string ) >& m_handler;
+    std::size_t m_leaf_digits{ format_leaf_digits };
+    std::vector< type > m_powers;
+    std::string m_chunk;
+};
+
+}// detail
+
+// Thrown by the fixed width number types instead of wrapping around
+class calculation_overflow : public std::overflow_error
+{
+public:
+    calculation_overflow() : std::overflow_error{ "Overflow" }{}
+};
+
+namespace detail
+{
+
+template< typename type >
+type calc_math( type& first, type& second, const operator_type& oper_type )
+{
+    if( oper_type == operator_type::division && second == type{ 0 } )
     {
-        m_operator_stack = {};
-        m_numbers = {};
-        m_expression_parts = {};
+        throw std::logic_error{ "Division by zero" };
     }
 
-    void clean_all()
+    type result{ std::move( first ) };
+
+    switch( oper_type )
     {
-        clean_parse_data();
+    case operator_type::addition: result += second; break;
+    case operator_type::substraction: result -= second; break;
+    case operator_type::multiplication: result *= second; break;
+    case operator_type::division: result /= second; break;
+    default: throw std::invalid_argument{ "Unimplemented math operator" }; break;
+    }
 
-        m_read_pos = 0;
-        m_running = false;
-        m_error_occured = false;
-        m_calculation_finished = false;
+    return result;
+}
+
+}// detail
+
+// Push parser: evaluates the expression chunk by chunk as the data arrives.
+// All the parse state lives in the object, so it never waits for the input
+// and may be driven by any thread, one chunk at a time
+template < typename type >
+class expression_evaluator
+{
+public:
+    expression_evaluator()
+    {
+        reset();
     }
 
-    type calc_math( type& first, type& second,
-                    const detail::operator_type& oper_type ) const
+    // Returns the number of consumed characters, it's less than size
+    // if the end of the expression has been reached in the middle of the chunk
+    std::size_t consume( const char* data, std::size_t size )
     {
         using namespace detail;
+        assert( data );
 
-        if( oper_type == detail::operator_type::division && second == type{ 0 } )
+        std::size_t pos{ 0 };
+
+        while( pos < size && m_state != parse_state::finished )
         {
-            throw std::logic_error{ "Division by zero" };
+            if( m_memo_buffering )
+            {
+                pos += buffer_group( data + pos, size - pos );
+                continue;
+            }
+
+            if( m_state == parse_state::number )
+            {
+                std::size_t digits_end{ pos };
+                while( digits_end < size && data[ digits_end ] >= '0' && data[ digits_end ] <= '9' )
+                {
+                    ++digits_end;
+                }
+
+                if( !m_skipping )
+                {
+                    m_number.append( data + pos, digits_end - pos );
+                }
+                else if( digits_end != pos && m_number == "-" )
+                {
+                    // a skipped number is only validated
+                    m_number += data[ pos ];
+                }
+
+                pos = digits_end;
+
+                // the terminating character is processed as an operator
+                if( pos < size )
+                {
+                    push_number( m_position + pos );
+                }
+
+                continue;
+            }
+
+            char c{ data[ pos ] };
+            if( c == '(' && m_state == parse_state::operand_expected && can_memoize() )
+            {
+                start_group( m_position + pos );
+                ++pos;
+                continue;
+            }
+
+            if( c != ' ' )
+            {
+                if( m_state == parse_state::operand_expected )
+                {
+                    on_operand_character( c );
+                }
+                else
+                {
+                    on_operator_character( c );
+                }
+            }
+
+            ++pos;
         }
 
-        type result{ std::move( first ) };
+        m_position += pos;
+        return pos;
+    }
+
+    bool finished() const noexcept{ return m_state == detail::parse_state::finished; }
+
+    // The memo should outlive the calculation, nullptr turns the memoization off
+    void set_memo( subexpression_memo< type >* memo ) noexcept{ m_memo = memo; }
 
-        switch( oper_type )
+    type result()
+    {
+        if( !finished() || m_numbers.size() != 1 )
         {
-        case operator_type::addition: result += second; break;
-        case operator_type::substraction: result -= second; break;
-        case operator_type::multiplication: result *= second; break;
-        case operator_type::division: result /= second; break;
-        default: throw std::invalid_argument{ "Unimplemented math operator" }; break;
+            throw std::logic_error{ "Invalid expression: end" };
         }
 
+        type result{ std::move( m_numbers.back().value ) };
+        m_numbers.pop_back();
+
         return result;
     }
 
-    char get_character()
+    void reset()
     {
-        if( !m_running )
+        m_numbers.clear();
+        m_operator_stack = {};
+        m_number.clear();
+        m_position = 0;
+        m_skip_next = false;
+        m_skipping = false;
+        m_skip_level = 0;
+        m_memo_buffering = false;
+        m_memo_replaying = false;
+        m_memo_text.clear();
+
+        m_operator_stack.push( detail::operator_type::subexpr_start );
+        m_state = detail::parse_state::operand_expected;
+    }
+
+private:
+    void on_operand_character( char c )
+    {
+        using namespace detail;
+        entry_type entry{ get_entry_type( c ) };
+
+        if( m_skip_next )
         {
-            throw calculation_aborted{};
+            // the operand ends when the stack gets back to this size
+            m_skip_next = false;
+            m_skipping = true;
+            m_skip_level = m_operator_stack.size();
         }
 
-        // remove ws and find first valid character or wait for more data
-        std::unique_lock< std::mutex > l { m_mutex };
+        if( entry == entry_type::opening_bracket )
+        {
+            m_operator_stack.push( operator_type::subexpr_start );
+        }
+        else if( entry == entry_type::number ||
+                 ( m_operator_stack.top() == operator_type::subexpr_start && c == '-' ) )
+        {
+            m_number += c;
+            m_state = parse_state::number;
+        }
+        else if( entry == entry_type::math && m_operator_stack.top() == operator_type::subexpr_start )
+        {
+            throw std::logic_error{ "Invalid expression: math sighs follows start of subexpression" };
+        }
+        else if( m_operator_stack.top() == operator_type::subexpr_start )
+        {
+            throw std::logic_error{ "Invalid expression: empty subexpression" };
+        }
+        else
+        {
+            throw std::logic_error{ "Invalid expression: not enough operator arguments provided" };
+        }
+    }
+
+    void on_operator_character( char c )
+    {
+        using namespace detail;
+        entry_type entry{ get_entry_type( c ) };
+
+        if( entry == entry_type::math )
+        {
+            operator_type new_oper{ get_oper_type( c ) };
+            calc_subexpression( new_oper );
+
+            // the product is zero already, the next factor is only validated. The run may be
+            // reduced partially, so the zero isn't necessarily the last operand.
+            // Divisors are calculated: the division by zero should still be reported
+            m_skip_next = !m_skipping && new_oper == operator_type::multiplication &&
+                          !m_numbers.empty() && m_numbers.back().zero_product;
 
-        while( true )
+            m_operator_stack.push( new_oper );
+            m_state = parse_state::operand_expected;
+        }
+        else if( entry == entry_type::closing_bracket || entry == entry_type::expr_end )
         {
-            if( m_expression_parts.empty() )
+            calc_subexpression( operator_type::end );
+
+            if( m_operator_stack.empty() || m_operator_stack.top() != operator_type::subexpr_first_num )
             {
-                m_cv.wait( l, [ this ](){ return ( !m_expression_parts.empty() || !m_running ); } );
-                if( !m_running )
-                {
-                    throw calculation_aborted{};
-                }
+                throw std::logic_error{ "Invalid expression: invalid brackets or operator position" };
             }
 
-            std::string& curr_part = m_expression_parts.front();
-            m_read_pos = curr_part.find_first_not_of( ' ', m_read_pos );
+            m_operator_stack.pop(); // pop subexpr_with_num
+            update_zero_product();
 
-            if( m_read_pos >= curr_part.length() )
+            if( entry == entry_type::expr_end )
             {
-                m_read_pos = 0;
-                m_expression_parts.pop();
+                if( !m_operator_stack.empty() )
+                {
+                    throw std::logic_error{ "Invalid expression: unclosed brackets" };
+                }
+
+                m_state = parse_state::finished;
             }
             else
             {
-                break;
+                maybe_swap_top_subexpr_start();
+                maybe_stop_skipping();
             }
         }
+        else
+        {
+            throw std::logic_error{ "Invalid expression: operator expected" };
+        }
+    }
+
+    void push_number( std::size_t pos )
+    {
+        if( m_number.empty() || ( m_number.length() == 1 && m_number.front() == '-' ) )
+        {
+            throw std::logic_error{ std::string{ "Invalid expression: number parse failed at " } + std::to_string( pos ) };
+        }
+
+        push_value( m_skipping? type{ 0 } : number_traits< type >::parse( m_number ) );
+        m_number.clear();
+    }
 
-        return m_expression_parts.front()[ m_read_pos ];
+    void push_value( type value )
+    {
+        m_numbers.emplace_back( std::move( value ), 0 );
+        update_zero_product();
+
+        maybe_swap_top_subexpr_start();
+        maybe_stop_skipping();
+        m_state = detail::parse_state::operator_expected;
     }
 
-    type parse_number()
+    // The skipped groups aren't calculated anyway, the replayed ones are already buffered
+    bool can_memoize() const noexcept
     {
-        std::string number;
+        return m_memo && !m_memo_replaying && !m_skip_next && !m_skipping;
+    }
 
-        char c{ get_character() };
-        if( c == '-' )
+    // The group is buffered instead of being calculated until it's closed
+    void start_group( std::size_t position )
+    {
+        m_memo_buffering = true;
+        m_memo_start = position;
+        m_memo_depth = 1;
+        m_memo_text.assign( 1, '(' );
+        m_memo_hash = memo_hash_step( 0, '(' );
+    }
+
+    // Returns the number of buffered characters
+    std::size_t buffer_group( const char* data, std::size_t size )
+    {
+        std::size_t pos{ 0 };
+        bool closed{ false };
+
+        while( pos < size && !closed && m_memo_text.length() + pos <= m_memo->max_text_size() )
         {
-            number += c;
-            ++m_read_pos;
-            c = get_character();
+            char c{ data[ pos ] };
+            if( c == '\n' || c == '\r' )
+            {
+                break;
+            }
+
+            m_memo_hash = memo_hash_step( m_memo_hash, c );
+            if( c == '(' )
+            {
+                ++m_memo_depth;
+            }
+            else if( c == ')' )
+            {
+                closed = --m_memo_depth == 0;
+            }
+
+            ++pos;
         }
 
-        while( detail::get_entry_type( c ) == detail::entry_type::number )
+        m_memo_text.append( data, pos );
+
+        if( closed )
         {
-            number += c;
-            ++m_read_pos;
-            c = get_character();
+            finish_group();
         }
+        else if( pos < size )
+        {
+            // too long or not closed by the end of the expression, calculated as usual
+            m_memo_buffering = false;
+            replay( m_memo_text );
+        }
+
+        return pos;
+    }
 
-        if( number.empty() || ( number.length() == 1 && number.front() == '-' ) )
+    void finish_group()
+    {
+        m_memo_buffering = false;
+
+        // the lookup costs more than the calculation of a short group
+        if( m_memo_text.length() < min_memo_text_size )
         {
-            throw std::logic_error{ std::string{ "Invalid expression: number parse failed at " } + std::to_string( m_read_pos ) };
-            //throw std::logic_error{ "Invalid expression: number parse failed" };
+            replay( m_memo_text );
+            return;
         }
 
-        --m_read_pos;
+        const type* value{ m_memo->find( m_memo_text, m_memo_hash ) };
+        if( value )
+        {
+            push_value( *value );
+            return;
+        }
 
-        return boost::lexical_cast< type >( number );
+        replay( m_memo_text );
+        m_memo->add( m_memo_text, m_memo_hash, m_numbers.back().value );
+    }
+
+    // Calculates the buffered text, the errors report its original positions
+    void replay( const std::string& text )
+    {
+        std::size_t position{ m_position };
+        m_position = m_memo_start;
+        m_memo_replaying = true;
+
+        consume( text.data(), text.length() );
+
+        m_memo_replaying = false;
+        m_position = position;
+    }
+
+    void maybe_stop_skipping() noexcept
+    {
+        if( m_skipping && m_operator_stack.size() == m_skip_level )
+        {
+            m_skipping = false;
+        }
     }
 
     void maybe_swap_top_subexpr_start()
@@ -260,118 +585,451 @@ private:
         while( !m_operator_stack.empty() &&
                get_precedence( oper ) <= get_precedence( m_operator_stack.top() ) )
         {
-            // All the supported operators reqiure at least two numbers
-            if( m_numbers.size() < 2 )
+            if( continues_run( m_operator_stack.top(), oper ) )
             {
-                throw std::logic_error{ "Invalid expression: not enough operator arguments provided" };
+                // a*b*c*d becomes (a*b)*(c*d): multiplying a growing giant by small numbers
+                // is much slower than multiplying the numbers of similar size
+                while( !m_operator_stack.empty() &&
+                       continues_run( m_operator_stack.top(), oper ) &&
+                       m_numbers.size() >= 2 &&
+                       top_operands_equal_rank() )
+                {
+                    reduce_top();
+                }
+
+                break;
             }
 
-            operator_type top_oper = m_operator_stack.top();
-            m_operator_stack.pop();
+            reduce_top();
+        }
+    }
 
-            type value{ std::move( m_numbers.top() ) };
-            m_numbers.pop();
+    bool top_operands_equal_rank() const noexcept
+    {
+        return m_numbers[ m_numbers.size() - 1 ].rank == m_numbers[ m_numbers.size() - 2 ].rank;
+    }
 
-            type older_value{ std::move( m_numbers.top() ) };
-            m_numbers.pop();
+    // Applies the top operator to the two top numbers
+    void reduce_top()
+    {
+        using namespace detail;
 
-            m_numbers.push( calc_math( older_value, value, top_oper ) );
-            maybe_swap_top_subexpr_start();
+        // All the supported operators reqiure at least two numbers
+        if( m_numbers.size() < 2 )
+        {
+            throw std::logic_error{ "Invalid expression: not enough operator arguments provided" };
+        }
+
+        operator_type top_oper = m_operator_stack.top();
+        m_operator_stack.pop();
+
+        // Within a run of additions and substractions the operator denotes the sign of its
+        // right operand in the whole run. Since the runs are reduced from the right,
+        // the result inherits the sign of the left operand: a - b + c = a - ( b - c )
+        if( !m_operator_stack.empty() && m_operator_stack.top() == operator_type::substraction )
+        {
+            if( top_oper == operator_type::addition )
+            {
+                top_oper = operator_type::substraction;
+            }
+            else if( top_oper == operator_type::substraction )
+            {
+                top_oper = operator_type::addition;
+            }
         }
+
+        operand< type > value{ std::move( m_numbers.back() ) };
+        m_numbers.pop_back();
+
+        operand< type > older_value{ std::move( m_numbers.back() ) };
+        m_numbers.pop_back();
+
+        uint32_t rank{ std::max( value.rank, older_value.rank ) + 1 };
+        m_numbers.emplace_back( m_skipping? type{ 0 } : calc_math( older_value.value, value.value, top_oper ), rank );
+        update_zero_product();
+        maybe_swap_top_subexpr_start();
     }
 
-    void parse_subexpression()
+    // The top operand is multiplied by the one below it if the operator between them is on the top
+    void update_zero_product()
     {
         using namespace detail;
-        assert( !m_operator_stack.empty() );
 
-        bool subexpr_parse_finished{ false };
+        operand< type >& top = m_numbers.back();
+        top.zero_product = top.value == type{ 0 } ||
+                           ( m_numbers.size() >= 2 && !m_operator_stack.empty() &&
+                             m_operator_stack.top() == operator_type::multiplication &&
+                             m_numbers[ m_numbers.size() - 2 ].zero_product );
+    }
+
+private:
+    std::vector< detail::operand< type > > m_numbers;
+    std::stack< detail::operator_type > m_operator_stack;
 
-        do
+    // digits of the number split between the chunks
+    std::string m_number;
+
+    // the factor following a zero is parsed without the number conversions and the math
+    bool m_skip_next{ false };
+    bool m_skipping{ false };
+    std::size_t m_skip_level{ 0 };
+
+    // text of the group being buffered for the memo lookup
+    subexpression_memo< type >* m_memo{ nullptr };
+    bool m_memo_buffering{ false };
+    bool m_memo_replaying{ false };
+    std::string m_memo_text;
+    uint64_t m_memo_hash{ 0 };
+    std::size_t m_memo_depth{ 0 };
+    std::size_t m_memo_start{ 0 };
+
+    std::size_t m_position{ 0 };
+    detail::parse_state m_state{ detail::parse_state::operand_expected };
+};
+
+// Feeds the received parts of the expression to the evaluator on the executor.
+// The calculation occupies a worker only while there is data to process
+template < typename type >
+class async_calculator
+{
+public:
+    // Groups up to memo_limit bytes are calculated once per expression, 0 turns the memo off
+    explicit async_calculator( executor& exec = executor::instance(), std::size_t memo_limit = 0 ) :
+        m_executor( exec )
+    {
+        if( memo_limit )
         {
-            char curr_char{ get_character() };
-            entry_type entry{ get_entry_type( curr_char ) };
+            m_memo.reset( new subexpression_memo< type >{ memo_limit } );
+            m_evaluator.set_memo( m_memo.get() );
+        }
+    }
 
-            if( entry == entry_type::opening_bracket )
-            {
-                m_operator_stack.push( operator_type::subexpr_start );
-                //parse_finished = true;
-            }
-            else if( entry == entry_type::closing_bracket || entry == entry_type::expr_end )
-            {
-                calc_subexpression( operator_type::end );
+    ~async_calculator()
+    {
+        // wait for the posted task to leave, it references this object
+        std::unique_lock< std::mutex > l{ m_mutex };
+        m_running = false;
+        m_cv.wait( l, [ this ](){ return !m_scheduled; } );
+    }
 
-                if( m_operator_stack.top() != operator_type::subexpr_first_num )
-                {
-                    throw std::logic_error{ "Invalid expression: empty subexpression" };
-                }
+    // Start new calculation
+    std::future< type > start( const std::string& expr_beginning )
+    {
+        return start_impl( expr_beginning );
+    }
 
-                m_operator_stack.pop(); // pop subexpr_with_num
+    std::future< type > start( std::string&& expr_beginning )
+    {
+        return start_impl( std::move( expr_beginning ) );
+    }
 
-                if( entry == entry_type::expr_end )
-                {
-                    m_calculation_finished = true;
-                }
-                else
-                {
-                    maybe_swap_top_subexpr_start();
-                }
+    // Add more data to the current calculation
+    void add_expr_part( const std::string& expr_part )
+    {
+       add_expr_part_impl( expr_part );
+    }
 
-                subexpr_parse_finished = true;
-            }
-            else if( entry == entry_type::number ||
-                     ( m_operator_stack.top() == operator_type::subexpr_start && curr_char == '-' ) )
+    void add_expr_part( std::string&& expr_part )
+    {
+       add_expr_part_impl( std::move( expr_part ) );
+    }
+
+    // Adds the rest of the expression already written to the file, it's read back
+    // like the parts spilled by the calculator itself. Nothing may be added after it
+    void add_spilled_parts( std::unique_ptr< spill_file > spill )
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        if( !m_running )
+        {
+            throw std::logic_error{ "Calculation is not running" };
+        }
+
+        if( m_spill_error || ( m_spill && m_spill->unread() ) )
+        {
+            throw std::logic_error{ "The spilled parts are not read out" };
+        }
+
+        m_spill = std::move( spill );
+        schedule();
+    }
+
+    void abort()
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        if( m_running )
+        {
+            // parked calculation should be woken up to report the abort
+            m_running = false;
+            schedule();
+        }
+    }
+
+    void reset()
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        if( m_running )
+        {
+            throw std::logic_error{ "Calculation is running" };
+        }
+
+        clean_all();
+    }
+
+    bool running() const noexcept{ return m_running; }
+    bool finished() const noexcept{ return m_calculation_finished; }
+    bool error_occured() const noexcept{ return m_error_occured; }
+
+    // Called on the compute thread right after the result future becomes ready.
+    // Shouldn't throw and shouldn't destroy the calculator
+    void set_completion_handler( std::function< void() > handler )
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        if( m_running )
+        {
+            throw std::logic_error{ "Calculation is running" };
+        }
+
+        m_completion_handler = std::move( handler );
+    }
+
+    // The queued parts are counted by the limiter until they are consumed
+    void set_ingest_limiter( ingest_limiter* limiter )
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        if( m_running )
+        {
+            throw std::logic_error{ "Calculation is running" };
+        }
+
+        m_limiter = limiter;
+    }
+
+private:
+    template< typename string_type >
+    std::future< type > start_impl( string_type&& expr_beginning )
+    {
+        if( expr_beginning.empty() )
+        {
+            throw std::invalid_argument{ "Empty expression" };
+        }
+
+        std::unique_lock< std::mutex > l{ m_mutex };
+        if( !m_running )
+        {
+            // aborted calculation may still be unwinding
+            m_cv.wait( l, [ this ](){ return !m_scheduled; } );
+            clean_all();
+
+            m_running = true;
+            m_result = std::promise< type >{};
+
+            push_part( std::forward< string_type >( expr_beginning ) );
+            std::future< type > result{ m_result.get_future() };
+            schedule();
+
+            return result;
+        }
+        else
+        {
+            throw std::logic_error{ "Another calculation is in progress" };
+        }
+    }
+
+    template< typename string_type >
+    void add_expr_part_impl( string_type&& expr_part )
+    {
+        if( expr_part.empty() )
+        {
+            throw std::invalid_argument{ "Empty expression" };
+        }
+
+        std::lock_guard< std::mutex > l{ m_mutex };
+        if( m_running )
+        {
+            push_part( std::forward< string_type >( expr_part ) );
+            schedule();
+        }
+        else
+        {
+            throw std::logic_error{ "Calculation is not running" };
+        }
+    }
+
+    // Should be called with m_mutex locked
+    template< typename string_type >
+    void push_part( string_type&& part )
+    {
+        if( spill_part( part ) )
+        {
+            return;
+        }
+
+        uint64_t size{ part.size() };
+        m_expression_parts.push_back( std::forward< string_type >( part ) );
+        m_queued_size += size;
+
+        if( m_limiter )
+        {
+            m_limiter->add( size );
+        }
+    }
+
+    // Should be called with m_mutex locked. Once started the spilling goes on until the file
+    // is read out, so the parts stay in order. Returns false if the part should be queued in memory
+    bool spill_part( const std::string& part )
+    {
+        bool spilling{ m_spill_error || ( m_spill && m_spill->unread() ) };
+        if( !spilling && !( m_limiter && m_limiter->should_spill( part.size() ) ) )
+        {
+            return false;
+        }
+
+        if( m_spill_error )
+        {
+            // the calculation fails once it reaches the lost data
+            return true;
+        }
+
+        try
+        {
+            if( !m_spill )
             {
-                m_numbers.push( parse_number() );
-                maybe_swap_top_subexpr_start();
+                m_spill.reset( new spill_file{ m_limiter->spill_directory() } );
             }
-            else if( entry == entry_type::math )
+
+            m_spill->append( part.data(), part.size() );
+        }
+        catch( const std::exception& )
+        {
+            if( !spilling )
             {
-                if( m_operator_stack.top() == operator_type::subexpr_start )
-                {
-                    throw std::logic_error{ "Invalid expression: math sighs follows start of subexpression" };
-                }
+                return false;
+            }
 
-                operator_type new_oper{ get_oper_type( curr_char ) };
-                if( m_operator_stack.top() != operator_type::subexpr_start &&
-                    m_operator_stack.top() != operator_type::subexpr_first_num )
-                {
-                    calc_subexpression( new_oper );
-                }
+            m_spill_error = std::current_exception();
+        }
 
-                m_operator_stack.push( new_oper );
-            }
+        return true;
+    }
+
+    // Should be called with m_mutex locked
+    void release_parts( uint64_t size )
+    {
+        m_queued_size -= size;
 
-            ++m_read_pos;
+        if( m_limiter )
+        {
+            m_limiter->release( size );
         }
-        while( !subexpr_parse_finished );
     }
 
-    type calculate()
+    // Should be called with m_mutex locked
+    void schedule()
     {
-        type result{};
+        if( !m_scheduled )
+        {
+            m_scheduled = true;
+            m_executor.post( [ this ](){ resume(); } );
+        }
+    }
 
-        try
+    void clean_parse_data()
+    {
+        m_evaluator.reset();
+        m_expression_parts = {};
+        release_parts( m_queued_size );
+        m_spill.reset();
+        m_spill_error = nullptr;
+
+        if( m_memo )
         {
-            m_operator_stack.push( detail::operator_type::subexpr_start );
+            m_memo->clear();
+        }
+    }
+
+    void clean_all()
+    {
+        clean_parse_data();
+
+        m_running = false;
+        m_error_occured = false;
+        m_calculation_finished = false;
+    }
 
-            while( !m_operator_stack.empty() && !m_calculation_finished )
+    // Runs on the executor until the calculation is finished or the received data is over
+    void resume()
+    {
+        try
+        {
+            while( !m_evaluator.finished() )
             {
-                parse_subexpression();
+                std::string part;
+                std::unique_ptr< mapped_file > spilled;
+
+                {
+                    std::lock_guard< std::mutex > l { m_mutex };
+                    if( !m_running )
+                    {
+                        throw calculation_aborted{};
+                    }
+
+                    if( m_expression_parts.empty() )
+                    {
+                        // the spilled parts are newer than the ones in memory
+                        if( m_spill && m_spill->unread() )
+                        {
+                            spilled = m_spill->map_unread();
+                        }
+                        else if( m_spill_error )
+                        {
+                            std::rethrow_exception( m_spill_error );
+                        }
+                        else
+                        {
+                            // add_expr_part() posts the calculation again once it sees it unscheduled,
+                            // so nothing may touch this object after the flag is dropped
+                            m_scheduled = false;
+                            m_cv.notify_all();
+                            return;
+                        }
+                    }
+                    else
+                    {
+                        part = std::move( m_expression_parts.front() );
+                        m_expression_parts.pop_front();
+                        release_parts( part.length() );
+                    }
+                }
+
+                if( spilled )
+                {
+                    m_evaluator.consume( spilled->data(), spilled->size() );
+
+                    uint64_t size{ spilled->size() };
+                    spilled.reset();
+
+                    std::lock_guard< std::mutex > l { m_mutex };
+                    m_spill->mark_read( size );
+                }
+                else
+                {
+                    m_evaluator.consume( part.data(), part.length() );
+                }
             }
 
             std::lock_guard< std::mutex > l { m_mutex };
 
-            if( m_expression_parts.size() != 1 ||
-                !m_operator_stack.empty() ||
-                m_numbers.size() != 1 )
+            if( !m_expression_parts.empty() || ( m_spill && m_spill->unread() ) || m_spill_error )
             {
                 throw std::logic_error{ "Invalid expression: end" };
             }
 
-            result = m_numbers.top();
-            m_numbers.pop();
+            type result{ m_evaluator.result() };
+            clean_parse_data();
+
             m_running = false;
+            m_calculation_finished = true;
+            m_result.set_value( std::move( result ) );
         }
         catch( ... )
         {
@@ -383,20 +1041,34 @@ private:
             clean_parse_data();
 
             // propagate exception to future
-            throw;
+            m_result.set_exception( std::current_exception() );
         }
 
-        clean_parse_data();
+        if( m_completion_handler )
+        {
+            m_completion_handler();
+        }
 
-        return result;
+        std::lock_guard< std::mutex > l { m_mutex };
+        m_scheduled = false;
+        m_cv.notify_all();
     }
 
 private:
-    std::stack< type > m_numbers;
-    std::stack< detail::operator_type > m_operator_stack;
-
-    std::size_t m_read_pos{ 0 };
-    std::queue< std::string > m_expression_parts;
+    std::unique_ptr< subexpression_memo< type > > m_memo;
+    expression_evaluator< type > m_evaluator;
+    std::deque< std::string > m_expression_parts;
+    uint64_t m_queued_size{ 0 };
+    ingest_limiter* m_limiter{ nullptr };
+
+    // the parts over the limiter's high watermark
+    std::unique_ptr< spill_file > m_spill;
+    std::exception_ptr m_spill_error;
+
+    executor& m_executor;
+    std::promise< type > m_result;
+    std::function< void() > m_completion_handler;
+    bool m_scheduled{ false };
 
     // not sure why, but simple m_running{ false }
     // causes gcc 4.8.4 to call deleted
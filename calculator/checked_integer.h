@@ -0,0 +1,150 @@
+#ifndef CHECKED_INTEGER_H
+#define CHECKED_INTEGER_H
+
+#include <string>
+#include <limits>
+#include <iostream>
+#include <algorithm>
+
+#include "calculator.h"
+
+namespace calc
+{
+
+// Fixed width integer(int64_t, __int128) that throws calculation_overflow instead of wrapping around.
+// The quotient is truncated towards zero like the one of the built-in integers, or with floor_division
+// rounded towards negative infinity like the one of BigInteger
+template< typename int_type, bool floor_division = false >
+class checked_integer
+{
+public:
+    checked_integer( int_type value = 0 ) noexcept : m_value( value ){}
+
+    int_type value() const noexcept{ return m_value; }
+
+    checked_integer& operator+=( const checked_integer& other )
+    {
+        if( __builtin_add_overflow( m_value, other.m_value, &m_value ) )
+        {
+            throw calculation_overflow{};
+        }
+
+        return *this;
+    }
+
+    checked_integer& operator-=( const checked_integer& other )
+    {
+        if( __builtin_sub_overflow( m_value, other.m_value, &m_value ) )
+        {
+            throw calculation_overflow{};
+        }
+
+        return *this;
+    }
+
+    checked_integer& operator*=( const checked_integer& other )
+    {
+        if( __builtin_mul_overflow( m_value, other.m_value, &m_value ) )
+        {
+            throw calculation_overflow{};
+        }
+
+        return *this;
+    }
+
+    // the only overflowing division is the minimal value by -1
+    checked_integer& operator/=( const checked_integer& other )
+    {
+        if( m_value == std::numeric_limits< int_type >::min() && other.m_value == -1 )
+        {
+            throw calculation_overflow{};
+        }
+
+        int_type quotient{ m_value / other.m_value };
+        if( floor_division && m_value % other.m_value && ( m_value < 0 ) != ( other.m_value < 0 ) )
+        {
+            --quotient;
+        }
+
+        m_value = quotient;
+        return *this;
+    }
+
+    bool operator==( const checked_integer& other ) const noexcept{ return m_value == other.m_value; }
+    bool operator!=( const checked_integer& other ) const noexcept{ return m_value != other.m_value; }
+
+    // written digit by digit: the standard streams don't know __int128
+    friend std::ostream& operator<<( std::ostream& os, const checked_integer& value )
+    {
+        std::string str;
+        int_type rest{ value.m_value };
+
+        do
+        {
+            int digit{ static_cast< int >( rest % 10 ) };
+            str += static_cast< char >( '0' + ( digit < 0? -digit : digit ) );
+            rest /= 10;
+        }
+        while( rest );
+
+        if( value.m_value < 0 )
+        {
+            str += '-';
+        }
+
+        std::reverse( str.begin(), str.end() );
+        return os << str;
+    }
+
+    // negative numbers are accumulated below zero to reach the minimal value
+    friend std::istream& operator>>( std::istream& is, checked_integer& value )
+    {
+        std::string str;
+        if( !( is >> str ) )
+        {
+            return is;
+        }
+
+        bool negative{ str[ 0 ] == '-' };
+        if( str.length() == ( negative? 1u : 0u ) )
+        {
+            is.setstate( std::ios_base::failbit );
+            return is;
+        }
+
+        int_type result{ 0 };
+        for( std::size_t i{ negative? 1u : 0u }; i < str.length(); ++i )
+        {
+            if( str[ i ] < '0' || str[ i ] > '9' )
+            {
+                is.setstate( std::ios_base::failbit );
+                return is;
+            }
+
+            int_type digit( str[ i ] - '0' );
+            if( __builtin_mul_overflow( result, 10, &result ) ||
+                ( negative? __builtin_sub_overflow( result, digit, &result ) :
+                            __builtin_add_overflow( result, digit, &result ) ) )
+            {
+                throw calculation_overflow{};
+            }
+        }
+
+        value = checked_integer{ result };
+        return is;
+    }
+
+private:
+    int_type m_value{ 0 };
+};
+
+using checked_int64 = checked_integer< int64_t >;
+using checked_int128 = checked_integer< __int128 >;
+
+// The fast type of the fallback to hybrid_integer< BigInteger >, so the quotients don't depend
+// on whether the expression was recalculated
+using floored_checked_int64 = checked_integer< int64_t, true >;
+
+} // calc
+
+#endif
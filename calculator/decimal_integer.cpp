@@ -0,0 +1,433 @@
+#include "decimal_integer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace calc
+{
+
+using limb = decimal_integer::limb;
+using limbs = std::vector< limb >;
+using wide = unsigned __int128;
+
+constexpr limb decimal_integer::base;
+constexpr std::size_t decimal_integer::limb_digits;
+
+static constexpr limb base{ decimal_integer::base };
+static constexpr std::size_t limb_digits{ decimal_integer::limb_digits };
+
+static int compare_magnitude( const limbs& l, const limbs& r ) noexcept
+{
+    if( l.size() != r.size() )
+    {
+        return l.size() < r.size()? -1 : 1;
+    }
+
+    for( std::size_t i{ l.size() }; i-- > 0; )
+    {
+        if( l[ i ] != r[ i ] )
+        {
+            return l[ i ] < r[ i ]? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+// l += r
+static void add_magnitude( limbs& l, const limbs& r )
+{
+    if( l.size() < r.size() )
+    {
+        l.resize( r.size(), 0 );
+    }
+
+    limb carry{ 0 };
+    for( std::size_t i{ 0 }; i < l.size() && ( carry || i < r.size() ); ++i )
+    {
+        // two limbs may not fit 64 bits
+        wide sum{ static_cast< wide >( l[ i ] ) + carry + ( i < r.size()? r[ i ] : 0 ) };
+        carry = sum >= base;
+        l[ i ] = static_cast< limb >( carry? sum - base : sum );
+    }
+
+    if( carry )
+    {
+        l.push_back( carry );
+    }
+}
+
+// result = bigger - smaller, the result may be one of the arguments
+static void sub_magnitude( const limbs& bigger, const limbs& smaller, limbs& result )
+{
+    result.resize( bigger.size() );
+
+    limb borrow{ 0 };
+    for( std::size_t i{ 0 }; i < bigger.size(); ++i )
+    {
+        limb subtrahend{ ( i < smaller.size()? smaller[ i ] : 0 ) + borrow };
+        borrow = bigger[ i ] < subtrahend;
+        result[ i ] = borrow? bigger[ i ] + ( base - subtrahend ) : bigger[ i ] - subtrahend;
+    }
+}
+
+static limbs mul_magnitude( const limbs& l, const limbs& r )
+{
+    limbs result( l.size() + r.size(), 0 );
+
+    for( std::size_t i{ 0 }; i < l.size(); ++i )
+    {
+        limb carry{ 0 };
+        for( std::size_t j{ 0 }; j < r.size(); ++j )
+        {
+            wide product{ static_cast< wide >( l[ i ] ) * r[ j ] + result[ i + j ] + carry };
+            carry = static_cast< limb >( product / base );
+            result[ i + j ] = static_cast< limb >( product % base );
+        }
+
+        result[ i + r.size() ] = carry;
+    }
+
+    return result;
+}
+
+// l *= factor, factor < base
+static void mul_magnitude( limbs& l, limb factor )
+{
+    limb carry{ 0 };
+    for( auto& value : l )
+    {
+        wide product{ static_cast< wide >( value ) * factor + carry };
+        carry = static_cast< limb >( product / base );
+        value = static_cast< limb >( product % base );
+    }
+
+    if( carry )
+    {
+        l.push_back( carry );
+    }
+}
+
+// l /= divisor, divisor < base
+static void div_magnitude( limbs& l, limb divisor )
+{
+    limb remainder{ 0 };
+    for( std::size_t i{ l.size() }; i-- > 0; )
+    {
+        wide current{ static_cast< wide >( remainder ) * base + l[ i ] };
+        l[ i ] = static_cast< limb >( current / divisor );
+        remainder = static_cast< limb >( current % divisor );
+    }
+}
+
+// Knuth's algorithm D, the divisor has at least two limbs and isn't bigger than the dividend
+static limbs div_magnitude( limbs u, limbs v )
+{
+    std::size_t n{ v.size() };
+    std::size_t m{ u.size() - n };
+
+    // normalization makes the top limb of the divisor at least base / 2,
+    // then the estimated quotient limb is at most two bigger than the real one
+    limb d{ base / ( v.back() + 1 ) };
+    mul_magnitude( u, d );
+    mul_magnitude( v, d );
+    u.resize( m + n + 1, 0 );
+
+    limbs q( m + 1, 0 );
+    for( std::size_t j{ m + 1 }; j-- > 0; )
+    {
+        wide numerator{ static_cast< wide >( u[ j + n ] ) * base + u[ j + n - 1 ] };
+        wide qhat{ numerator / v[ n - 1 ] };
+        wide rhat{ numerator % v[ n - 1 ] };
+
+        while( qhat >= base || qhat * v[ n - 2 ] > rhat * base + u[ j + n - 2 ] )
+        {
+            --qhat;
+            rhat += v[ n - 1 ];
+            if( rhat >= base )
+            {
+                break;
+            }
+        }
+
+        // u[ j .. j + n ] -= qhat * v
+        limb carry{ 0 };
+        limb borrow{ 0 };
+        for( std::size_t i{ 0 }; i < n; ++i )
+        {
+            wide product{ qhat * v[ i ] + carry };
+            carry = static_cast< limb >( product / base );
+
+            limb subtrahend{ static_cast< limb >( product % base ) + borrow };
+            borrow = u[ i + j ] < subtrahend;
+            u[ i + j ] = borrow? u[ i + j ] + ( base - subtrahend ) : u[ i + j ] - subtrahend;
+        }
+
+        limb subtrahend{ carry + borrow };
+        if( u[ j + n ] < subtrahend )
+        {
+            // the estimate was one too big, add the divisor back
+            --qhat;
+            limb add_carry{ 0 };
+            for( std::size_t i{ 0 }; i < n; ++i )
+            {
+                wide sum{ static_cast< wide >( u[ i + j ] ) + v[ i ] + add_carry };
+                add_carry = sum >= base;
+                u[ i + j ] = static_cast< limb >( add_carry? sum - base : sum );
+            }
+
+            u[ j + n ] = u[ j + n ] + add_carry - subtrahend;
+        }
+        else
+        {
+            u[ j + n ] -= subtrahend;
+        }
+
+        q[ j ] = static_cast< limb >( qhat );
+    }
+
+    return q;
+}
+
+decimal_integer::decimal_integer( int64_t value ) :
+    m_negative( value < 0 )
+{
+    // the minimal value has no positive counterpart
+    uint64_t magnitude{ value < 0? ~static_cast< uint64_t >( value ) + 1 : static_cast< uint64_t >( value ) };
+
+    while( magnitude )
+    {
+        m_limbs.push_back( magnitude % base );
+        magnitude /= base;
+    }
+}
+
+decimal_integer& decimal_integer::operator+=( const decimal_integer& other )
+{
+    add_signed( other, other.m_negative );
+    return *this;
+}
+
+decimal_integer& decimal_integer::operator-=( const decimal_integer& other )
+{
+    add_signed( other, !other.m_negative );
+    return *this;
+}
+
+decimal_integer& decimal_integer::operator*=( const decimal_integer& other )
+{
+    if( m_limbs.empty() || other.m_limbs.empty() )
+    {
+        m_limbs.clear();
+    }
+    else if( other.m_limbs.size() == 1 )
+    {
+        mul_magnitude( m_limbs, other.m_limbs.front() );
+    }
+    else if( m_limbs.size() == 1 )
+    {
+        limb factor{ m_limbs.front() };
+        m_limbs = other.m_limbs;
+        mul_magnitude( m_limbs, factor );
+    }
+    else
+    {
+        m_limbs = mul_magnitude( m_limbs, other.m_limbs );
+    }
+
+    m_negative = m_negative != other.m_negative;
+    normalize();
+
+    return *this;
+}
+
+decimal_integer& decimal_integer::operator/=( const decimal_integer& other )
+{
+    if( other.m_limbs.empty() )
+    {
+        throw std::logic_error{ "Division by zero" };
+    }
+
+    if( compare_magnitude( m_limbs, other.m_limbs ) < 0 )
+    {
+        m_limbs.clear();
+    }
+    else if( other.m_limbs.size() == 1 )
+    {
+        div_magnitude( m_limbs, other.m_limbs.front() );
+    }
+    else
+    {
+        m_limbs = div_magnitude( std::move( m_limbs ), other.m_limbs );
+    }
+
+    m_negative = m_negative != other.m_negative;
+    normalize();
+
+    return *this;
+}
+
+bool decimal_integer::operator==( const decimal_integer& other ) const noexcept
+{
+    return m_negative == other.m_negative && m_limbs == other.m_limbs;
+}
+
+bool decimal_integer::operator!=( const decimal_integer& other ) const noexcept
+{
+    return !( *this == other );
+}
+
+std::string decimal_integer::to_string() const
+{
+    if( m_limbs.empty() )
+    {
+        return "0";
+    }
+
+    std::string result{ m_negative? "-" : "" };
+    result += std::to_string( m_limbs.back() );
+
+    // the lower limbs are written with the leading zeroes
+    std::size_t pos{ result.length() };
+    result.resize( pos + ( m_limbs.size() - 1 ) * limb_digits, '0' );
+
+    for( std::size_t i{ m_limbs.size() - 1 }; i-- > 0; )
+    {
+        limb value{ m_limbs[ i ] };
+        pos += limb_digits;
+
+        for( std::size_t digit{ 1 }; digit <= limb_digits && value; ++digit )
+        {
+            result[ pos - digit ] = static_cast< char >( '0' + value % 10 );
+            value /= 10;
+        }
+    }
+
+    return result;
+}
+
+void decimal_integer::to_chunks( const std::function< void( std::string ) >& handler, std::size_t chunk_limbs ) const
+{
+    if( m_limbs.empty() )
+    {
+        handler( "0" );
+        return;
+    }
+
+    chunk_limbs = std::max< std::size_t >( chunk_limbs, 1 );
+
+    std::string chunk{ m_negative? "-" : "" };
+    chunk += std::to_string( m_limbs.back() );
+
+    for( std::size_t i{ m_limbs.size() - 1 }; i-- > 0; )
+    {
+        limb value{ m_limbs[ i ] };
+        std::size_t pos{ chunk.length() };
+        chunk.resize( pos + limb_digits, '0' );
+
+        for( std::size_t digit{ limb_digits }; digit > 0 && value; --digit )
+        {
+            chunk[ pos + digit - 1 ] = static_cast< char >( '0' + value % 10 );
+            value /= 10;
+        }
+
+        if( chunk.length() >= chunk_limbs * limb_digits )
+        {
+            handler( std::move( chunk ) );
+            chunk = std::string{};
+        }
+    }
+
+    if( !chunk.empty() )
+    {
+        handler( std::move( chunk ) );
+    }
+}
+
+decimal_integer decimal_integer::parse( const std::string& str )
+{
+    bool negative{ !str.empty() && str.front() == '-' };
+    std::size_t first{ negative? 1u : 0u };
+
+    if( first == str.length() )
+    {
+        throw std::invalid_argument{ "Invalid number" };
+    }
+
+    decimal_integer result;
+    result.m_negative = negative;
+    result.m_limbs.reserve( ( str.length() - first ) / limb_digits + 1 );
+
+    // the limbs are read from the lowest digits
+    for( std::size_t end{ str.length() }; end > first; )
+    {
+        std::size_t begin{ end - std::min( end - first, limb_digits ) };
+
+        limb value{ 0 };
+        for( std::size_t i{ begin }; i < end; ++i )
+        {
+            if( str[ i ] < '0' || str[ i ] > '9' )
+            {
+                throw std::invalid_argument{ "Invalid number" };
+            }
+
+            value = value * 10 + static_cast< limb >( str[ i ] - '0' );
+        }
+
+        result.m_limbs.push_back( value );
+        end = begin;
+    }
+
+    result.normalize();
+    return result;
+}
+
+std::ostream& operator<<( std::ostream& os, const decimal_integer& value )
+{
+    return os << value.to_string();
+}
+
+std::istream& operator>>( std::istream& is, decimal_integer& value )
+{
+    std::string str;
+    if( is >> str )
+    {
+        value = decimal_integer::parse( str );
+    }
+
+    return is;
+}
+
+void decimal_integer::add_signed( const decimal_integer& other, bool other_negative )
+{
+    if( m_negative == other_negative )
+    {
+        add_magnitude( m_limbs, other.m_limbs );
+    }
+    else if( compare_magnitude( m_limbs, other.m_limbs ) >= 0 )
+    {
+        sub_magnitude( m_limbs, other.m_limbs, m_limbs );
+    }
+    else
+    {
+        sub_magnitude( other.m_limbs, m_limbs, m_limbs );
+        m_negative = other_negative;
+    }
+
+    normalize();
+}
+
+void decimal_integer::normalize() noexcept
+{
+    while( !m_limbs.empty() && !m_limbs.back() )
+    {
+        m_limbs.pop_back();
+    }
+
+    if( m_limbs.empty() )
+    {
+        m_negative = false;
+    }
+}
+
+} // calc
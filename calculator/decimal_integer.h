@@ -0,0 +1,80 @@
+#ifndef DECIMAL_INTEGER_H
+#define DECIMAL_INTEGER_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+
+#include "calculator.h"
+
+namespace calc
+{
+
+// Arbitrary precision integer stored in base 10^19 limbs, so the decimal text is converted
+// to and from it in a single linear pass, without the quadratic base conversions of
+// the binary big integers. Meant for the expressions dominated by huge literals and
+// additions, multiplication and division are schoolbook. The quotient is truncated towards zero
+class decimal_integer
+{
+public:
+    using limb = uint64_t;
+    static constexpr limb base{ 10000000000000000000ull };
+    static constexpr std::size_t limb_digits{ 19 };
+
+    decimal_integer( int64_t value = 0 );
+
+    decimal_integer& operator+=( const decimal_integer& other );
+    decimal_integer& operator-=( const decimal_integer& other );
+    decimal_integer& operator*=( const decimal_integer& other );
+    decimal_integer& operator/=( const decimal_integer& other );
+
+    bool operator==( const decimal_integer& other ) const noexcept;
+    bool operator!=( const decimal_integer& other ) const noexcept;
+
+    std::string to_string() const;
+
+    // Writes the text by up to chunk_limbs limbs at a time, the most significant ones first
+    void to_chunks( const std::function< void( std::string ) >& handler, std::size_t chunk_limbs ) const;
+    static decimal_integer parse( const std::string& str );
+
+    friend std::ostream& operator<<( std::ostream& os, const decimal_integer& value );
+    friend std::istream& operator>>( std::istream& is, decimal_integer& value );
+
+private:
+    void add_signed( const decimal_integer& other, bool other_negative );
+    void normalize() noexcept;
+
+private:
+    // little endian, no leading zero limbs, zero has none
+    std::vector< limb > m_limbs;
+    bool m_negative{ false };
+};
+
+template<>
+struct number_traits< decimal_integer >
+{
+    static decimal_integer parse( const std::string& str )
+    {
+        return decimal_integer::parse( str );
+    }
+
+    static std::string format( const decimal_integer& value )
+    {
+        return value.to_string();
+    }
+};
+
+// the limbs are already decimal, the chunks are written from the top ones
+template<>
+struct progressive_format< decimal_integer >
+{
+    static void format( const decimal_integer& value, const std::function< void( std::string ) >& handler )
+    {
+        value.to_chunks( handler, detail::format_chunk_size / decimal_integer::limb_digits );
+    }
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,348 @@
+#include "disk_result_store.h"
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "logger.h"
+#include "mapped_file.h"
+
+namespace network
+{
+
+static constexpr uint32_t store_magic{ 0x32534552 }; // "RES2"
+static constexpr uint64_t limb_base{ 10000000000000000000ull };
+static constexpr std::size_t limb_digits{ 19 };
+static constexpr const char* store_suffix{ ".res" };
+
+// Followed by limb_count little endian base 10^19 limbs, the lowest first.
+// The key of the expression is checked on the load, the name of the file alone isn't trusted
+struct stored_header
+{
+    uint32_t magic;
+    uint32_t negative;
+    uint64_t digest[ 4 ];
+    uint64_t expression_size;
+    uint64_t limb_count;
+};
+
+static bool pack_result( const content_key& key, const std::string& result, std::string& packed )
+{
+    bool negative{ !result.empty() && result.front() == '-' };
+    std::size_t first{ negative? 1u : 0u };
+
+    if( first == result.length() || ( result[ first ] == '0' && result.length() > first + 1 ) ||
+        !std::all_of( result.begin() + first, result.end(), []( char c ){ return c >= '0' && c <= '9'; } ) )
+    {
+        return false;
+    }
+
+    std::vector< uint64_t > limbs;
+    for( std::size_t end{ result.length() }; end > first; )
+    {
+        std::size_t begin{ end - std::min( end - first, limb_digits ) };
+
+        uint64_t limb{ 0 };
+        for( std::size_t i{ begin }; i < end; ++i )
+        {
+            limb = limb * 10 + static_cast< uint64_t >( result[ i ] - '0' );
+        }
+
+        limbs.push_back( limb );
+        end = begin;
+    }
+
+    // zero has no limbs
+    if( limbs.size() == 1 && !limbs.front() )
+    {
+        limbs.clear();
+    }
+
+    stored_header header;
+    header.magic = store_magic;
+    header.negative = negative? 1u : 0u;
+    std::copy( key.digest.begin(), key.digest.end(), header.digest );
+    header.expression_size = key.size;
+    header.limb_count = limbs.size();
+
+    packed.assign( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+    packed.append( reinterpret_cast< const char* >( limbs.data() ), limbs.size() * sizeof( uint64_t ) );
+
+    return true;
+}
+
+static bool unpack_result( const content_key& key, const char* data, uint64_t size, std::string& result )
+{
+    stored_header header;
+    if( size < sizeof( header ) )
+    {
+        return false;
+    }
+
+    std::memcpy( &header, data, sizeof( header ) );
+    if( header.magic != store_magic || header.negative > 1 ||
+        !std::equal( key.digest.begin(), key.digest.end(), header.digest ) || header.expression_size != key.size ||
+        header.limb_count != ( size - sizeof( header ) ) / sizeof( uint64_t ) ||
+        ( size - sizeof( header ) ) % sizeof( uint64_t ) )
+    {
+        return false;
+    }
+
+    if( !header.limb_count )
+    {
+        result = "0";
+        return true;
+    }
+
+    std::vector< uint64_t > limbs( header.limb_count );
+    std::memcpy( limbs.data(), data + sizeof( header ), limbs.size() * sizeof( uint64_t ) );
+
+    if( !limbs.back() || std::any_of( limbs.begin(), limbs.end(), []( uint64_t limb ){ return limb >= limb_base; } ) )
+    {
+        return false;
+    }
+
+    result = header.negative? "-" : "";
+    result += std::to_string( limbs.back() );
+
+    // the lower limbs are written with the leading zeroes
+    std::size_t pos{ result.length() };
+    result.resize( pos + ( limbs.size() - 1 ) * limb_digits, '0' );
+
+    for( std::size_t i{ limbs.size() - 1 }; i-- > 0; )
+    {
+        uint64_t limb{ limbs[ i ] };
+        pos += limb_digits;
+
+        for( std::size_t digit{ 1 }; digit <= limb_digits && limb; ++digit )
+        {
+            result[ pos - digit ] = static_cast< char >( '0' + limb % 10 );
+            limb /= 10;
+        }
+    }
+
+    return true;
+}
+
+// The digest words and the text length, 16 hex digits each
+static constexpr std::size_t name_words{ 5 };
+static constexpr std::size_t name_length{ name_words * 16 };
+
+static std::string hex_word( uint64_t word )
+{
+    char text[ 17 ];
+    std::snprintf( text, sizeof( text ), "%016llx", static_cast< unsigned long long >( word ) );
+
+    return text;
+}
+
+static bool parse_file_name( const std::string& name, content_key& key )
+{
+    std::size_t suffix_length{ std::strlen( store_suffix ) };
+    if( name.length() != name_length + suffix_length || name.compare( name_length, suffix_length, store_suffix ) != 0 )
+    {
+        return false;
+    }
+
+    uint64_t words[ name_words ]{};
+    for( std::size_t i{ 0 }; i < name_length; ++i )
+    {
+        char c{ name[ i ] };
+        int digit{ c >= '0' && c <= '9'? c - '0' : c >= 'a' && c <= 'f'? c - 'a' + 10 : -1 };
+        if( digit < 0 )
+        {
+            return false;
+        }
+
+        words[ i / 16 ] = words[ i / 16 ] * 16 + static_cast< uint64_t >( digit );
+    }
+
+    std::copy( words, words + key.digest.size(), key.digest.begin() );
+    key.size = words[ key.digest.size() ];
+
+    return true;
+}
+
+disk_result_store::disk_result_store( const std::string& directory, uint64_t max_size ) :
+    m_directory( directory ),
+    m_max_size( max_size )
+{
+    if( ::mkdir( m_directory.c_str(), 0755 ) != 0 && errno != EEXIST )
+    {
+        throw std::ios_base::failure{ "Failed to create directory: " + m_directory };
+    }
+
+    DIR* dir{ ::opendir( m_directory.c_str() ) };
+    if( !dir )
+    {
+        throw std::ios_base::failure{ "Failed to open directory: " + m_directory };
+    }
+
+    // the files are indexed from the least recently used one
+    std::vector< std::pair< int64_t, file_info > > files;
+    while( dirent* entry = ::readdir( dir ) )
+    {
+        std::string name{ entry->d_name };
+        std::string file_path{ m_directory + "/" + name };
+
+        struct stat info;
+        file_info file;
+        if( !parse_file_name( name, file.key ) || ::stat( file_path.c_str(), &info ) != 0 )
+        {
+            continue;
+        }
+
+        file.size = static_cast< uint64_t >( info.st_size );
+        files.emplace_back( static_cast< int64_t >( info.st_mtim.tv_sec ) * 1000000000 + info.st_mtim.tv_nsec, file );
+    }
+
+    ::closedir( dir );
+
+    std::sort( files.begin(), files.end(), []( const std::pair< int64_t, file_info >& l,
+                                              const std::pair< int64_t, file_info >& r )
+    {
+        return l.first < r.first;
+    } );
+
+    for( const auto& file : files )
+    {
+        remember( file.second.key, file.second.size );
+    }
+
+    evict();
+}
+
+bool disk_result_store::load( const content_key& key, std::string& result )
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        auto found = m_index.find( key );
+        if( found == m_index.end() )
+        {
+            return false;
+        }
+
+        m_files.splice( m_files.begin(), m_files, found->second );
+    }
+
+    std::string file_path{ path( key ) };
+
+    try
+    {
+        calc::mapped_file file{ file_path };
+        if( unpack_result( key, file.data(), file.size(), result ) )
+        {
+            // the modification time orders the files after the restart
+            ::utimensat( AT_FDCWD, file_path.c_str(), nullptr, 0 );
+            return true;
+        }
+
+        logger::log( "Invalid stored result: " + file_path, logger::to::cerr );
+    }
+    catch( const std::exception& e )
+    {
+        // removed by another server sharing the directory
+        logger::log( e.what(), logger::to::cerr );
+    }
+
+    std::lock_guard< std::mutex > l{ m_mutex };
+    forget( key );
+    std::remove( file_path.c_str() );
+
+    return false;
+}
+
+void disk_result_store::save( const content_key& key, const std::string& result )
+{
+    std::string packed;
+    if( !pack_result( key, result, packed ) || packed.size() > m_max_size )
+    {
+        return;
+    }
+
+    // renamed once complete, so a crash never leaves a partial result
+    std::string file_path{ path( key ) };
+    std::string temp_path{ file_path + ".tmp" };
+
+    {
+        std::ofstream file{ temp_path, std::ios::binary | std::ios::trunc };
+        file.write( packed.data(), static_cast< std::streamsize >( packed.size() ) );
+
+        if( !file.good() )
+        {
+            logger::log( "Failed to store result: " + temp_path, logger::to::cerr );
+            file.close();
+            std::remove( temp_path.c_str() );
+            return;
+        }
+    }
+
+    if( std::rename( temp_path.c_str(), file_path.c_str() ) != 0 )
+    {
+        logger::log( "Failed to store result: " + file_path, logger::to::cerr );
+        std::remove( temp_path.c_str() );
+        return;
+    }
+
+    std::lock_guard< std::mutex > l{ m_mutex };
+    forget( key );
+    remember( key, packed.size() );
+    evict();
+}
+
+std::string disk_result_store::path( const content_key& key ) const
+{
+    std::string name;
+    for( uint64_t word : key.digest )
+    {
+        name += hex_word( word );
+    }
+
+    return m_directory + "/" + name + hex_word( key.size ) + store_suffix;
+}
+
+// Should be called with m_mutex locked
+void disk_result_store::remember( const content_key& key, uint64_t size )
+{
+    file_info file;
+    file.key = key;
+    file.size = size;
+
+    m_files.push_front( file );
+    m_index[ key ] = m_files.begin();
+    m_size += size;
+}
+
+// Should be called with m_mutex locked
+void disk_result_store::forget( const content_key& key )
+{
+    auto found = m_index.find( key );
+    if( found != m_index.end() )
+    {
+        m_size -= found->second->size;
+        m_files.erase( found->second );
+        m_index.erase( found );
+    }
+}
+
+// Should be called with m_mutex locked
+void disk_result_store::evict()
+{
+    while( m_size > m_max_size && !m_files.empty() )
+    {
+        const file_info& oldest = m_files.back();
+        std::remove( path( oldest.key ).c_str() );
+
+        m_size -= oldest.size;
+        m_index.erase( oldest.key );
+        m_files.pop_back();
+    }
+}
+
+}// network
@@ -0,0 +1,57 @@
+#ifndef DISK_RESULT_STORE_H
+#define DISK_RESULT_STORE_H
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "result_cache.h"
+
+namespace network
+{
+
+static constexpr uint64_t default_store_size{ 1ull << 30 };
+
+// Results kept in a directory between the server runs, one file per expression named by its
+// SHA-256 digest and length. The numbers are stored as base 10^19 binary limbs along with the key,
+// a load maps the file, checks the key and converts the limbs to a new string of the result.
+// The least recently used files(by their modification time) are removed beyond the size limit
+class disk_result_store
+{
+public:
+    // Creates the directory if it's missing and indexes the files left by the previous runs
+    disk_result_store( const std::string& directory, uint64_t max_size = default_store_size );
+
+    bool load( const content_key& key, std::string& result );
+
+    // The results that aren't integers aren't stored
+    void save( const content_key& key, const std::string& result );
+
+private:
+    struct file_info
+    {
+        content_key key;
+        uint64_t size{ 0 };
+    };
+
+    std::string path( const content_key& key ) const;
+    void remember( const content_key& key, uint64_t size );
+    void forget( const content_key& key );
+    void evict();
+
+private:
+    std::string m_directory;
+    uint64_t m_max_size{ default_store_size };
+    uint64_t m_size{ 0 };
+
+    // the most recently used first
+    std::list< file_info > m_files;
+    std::unordered_map< content_key, std::list< file_info >::iterator, content_key_hash > m_index;
+
+    std::mutex m_mutex;
+};
+
+}// network
+
+#endif
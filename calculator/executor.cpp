@@ -0,0 +1,221 @@
+#include "executor.h"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include "logger.h"
+
+namespace calc
+{
+
+static std::atomic< uint32_t > instance_workers_num{ 0 };
+static std::atomic_bool instance_created{ false };
+
+// The executor the thread is a worker of
+static thread_local executor* current_executor{ nullptr };
+
+executor::executor( uint32_t workers_num )
+{
+    if( !workers_num )
+    {
+        throw std::invalid_argument{ "Executor should have at least one worker" };
+    }
+
+    try
+    {
+        for( uint32_t i{ 0 }; i < workers_num; ++i )
+        {
+            m_workers.emplace_back( &executor::run, this );
+        }
+    }
+    catch( ... )
+    {
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            m_stopped = true;
+        }
+
+        m_cv.notify_all();
+        for( auto& worker : m_workers )
+        {
+            worker.join();
+        }
+
+        throw;
+    }
+}
+
+executor::~executor()
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_stopped = true;
+    }
+
+    m_cv.notify_all();
+    for( auto& worker : m_workers )
+    {
+        worker.join();
+    }
+}
+
+void executor::post( task t )
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        if( m_stopped )
+        {
+            throw std::logic_error{ "Executor is stopped" };
+        }
+
+        m_tasks.push( std::move( t ) );
+    }
+
+    m_cv.notify_one();
+}
+
+void executor::run_parallel( std::size_t count, const std::function< void( std::size_t ) >& body )
+{
+    // shared with the posted tasks, the ones still queued after the return find no index left
+    struct parallel_run
+    {
+        std::atomic< std::size_t > next{ 0 };
+        std::size_t left{ 0 };
+        std::vector< std::exception_ptr > errors;
+
+        std::mutex m;
+        std::condition_variable cv;
+    };
+
+    auto state = std::make_shared< parallel_run >();
+    state->left = count;
+    state->errors.resize( count );
+
+    // the body is only called for the claimed indices, so it's alive while it's used
+    const std::function< void( std::size_t ) >* body_ptr{ &body };
+    auto run_bodies = [ state, body_ptr, count ]()
+    {
+        for( std::size_t i{ state->next++ }; i < count; i = state->next++ )
+        {
+            try
+            {
+                ( *body_ptr )( i );
+            }
+            catch( ... )
+            {
+                state->errors[ i ] = std::current_exception();
+            }
+
+            std::lock_guard< std::mutex > l{ state->m };
+            if( !--state->left )
+            {
+                state->cv.notify_all();
+            }
+        }
+    };
+
+    std::size_t tasks{ std::min< std::size_t >( count, m_workers.size() ) };
+    for( std::size_t i{ 0 }; i < tasks; ++i )
+    {
+        try
+        {
+            post( run_bodies );
+        }
+        catch( ... )
+        {
+            // the claimed bodies refer to this frame
+            std::size_t claimed{ std::min( state->next.exchange( count ), count ) };
+
+            std::unique_lock< std::mutex > l{ state->m };
+            state->left -= count - claimed;
+            state->cv.wait( l, [ & ](){ return !state->left; } );
+            throw;
+        }
+    }
+
+    // a worker waiting for the others could leave the bodies queued behind the waiting
+    // workers forever, so it runs the unclaimed ones itself
+    if( current_executor == this )
+    {
+        run_bodies();
+    }
+
+    {
+        std::unique_lock< std::mutex > l{ state->m };
+        state->cv.wait( l, [ & ](){ return !state->left; } );
+    }
+
+    for( const auto& error : state->errors )
+    {
+        if( error )
+        {
+            std::rethrow_exception( error );
+        }
+    }
+}
+
+uint32_t executor::workers_num() const noexcept
+{
+    return static_cast< uint32_t >( m_workers.size() );
+}
+
+executor& executor::instance()
+{
+    static executor e{ instance_workers_num? instance_workers_num.load() : default_workers_num() };
+    instance_created = true;
+    return e;
+}
+
+void executor::set_instance_workers_num( uint32_t workers_num )
+{
+    if( instance_created )
+    {
+        throw std::logic_error{ "Executor instance is already created" };
+    }
+
+    instance_workers_num = workers_num;
+}
+
+uint32_t executor::default_workers_num() noexcept
+{
+    uint32_t num{ std::thread::hardware_concurrency() };
+    return num? num : 1;
+}
+
+void executor::run()
+{
+    current_executor = this;
+
+    while( true )
+    {
+        task t;
+
+        {
+            std::unique_lock< std::mutex > l{ m_mutex };
+            m_cv.wait( l, [ this ](){ return m_stopped || !m_tasks.empty(); } );
+
+            // finish the queued work before stopping
+            if( m_tasks.empty() )
+            {
+                break;
+            }
+
+            t = std::move( m_tasks.front() );
+            m_tasks.pop();
+        }
+
+        try
+        {
+            t();
+        }
+        catch( const std::exception& e )
+        {
+            logger::log( e.what(), logger::to::cerr );
+        }
+    }
+}
+
+} // calc
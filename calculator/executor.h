@@ -0,0 +1,57 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace calc
+{
+
+// Fixed size pool of compute threads shared by all the calculations in the process.
+// Tasks are expected to never block waiting for network data: calculations that
+// run out of input return and get posted again once more data arrives
+class executor
+{
+public:
+    using task = std::function< void() >;
+
+    explicit executor( uint32_t workers_num = default_workers_num() );
+    ~executor();
+
+    executor( const executor& ) = delete;
+    executor& operator=( const executor& ) = delete;
+
+    void post( task t );
+    uint32_t workers_num() const noexcept;
+
+    // Runs body( 0 ) .. body( count - 1 ) on the workers and waits for all of them, the exception
+    // of the lowest index is rethrown. Called from a worker, it also runs the bodies itself,
+    // so the nested calls complete even when all the workers wait for their own ones
+    void run_parallel( std::size_t count, const std::function< void( std::size_t ) >& body );
+
+    // Process-wide instance, created on first use
+    static executor& instance();
+
+    // Should be called before the first call to instance()
+    static void set_instance_workers_num( uint32_t workers_num );
+    static uint32_t default_workers_num() noexcept;
+
+private:
+    void run();
+
+private:
+    std::vector< std::thread > m_workers;
+    std::queue< task > m_tasks;
+    bool m_stopped{ false };
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+} // calc
+
+#endif
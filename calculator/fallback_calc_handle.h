@@ -0,0 +1,327 @@
+#ifndef FALLBACK_CALC_HANDLE_H
+#define FALLBACK_CALC_HANDLE_H
+
+#include <memory>
+#include <cstdlib>
+
+#include "calc_handle.h"
+
+namespace calc
+{
+
+// Bytes of the expression kept in memory for the retry, the rest goes to a spill file
+static constexpr uint64_t default_retry_buffer_size{ 4 << 20 };
+
+// Calculates the expression with the fast fixed width type first and recalculates it with
+// the exact type only if the numbers didn't fit. The expression is buffered until the fast
+// result is known, so the retry doesn't need the client to send anything again. Only its beginning
+// stays in memory, the rest is spilled to the spill directory of the limiter(or TMPDIR without one)
+template< typename fast_type, typename exact_type >
+class fallback_calc_handle : public abstract_calc_handle
+{
+public:
+    explicit fallback_calc_handle( uint64_t inline_limit = default_inline_limit, std::size_t memo_limit = 0,
+                                   uint64_t retry_buffer_size = default_retry_buffer_size ) :
+        m_inline_limit( inline_limit ),
+        m_memo_limit( memo_limit ),
+        m_retry_buffer_size( retry_buffer_size ),
+        m_fast( inline_limit, memo_limit ){}
+
+    void on_data( const char* data, uint64_t size, bool end = false ) override
+    {
+        assert( data );
+
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            m_started = true;
+            buffer_part( data, size );
+        }
+
+        m_fast.on_data( data, size, end );
+
+        if( end )
+        {
+            m_fast.async_get_result( std::bind( &fallback_calc_handle::on_fast_result, this, std::placeholders::_1 ) );
+        }
+    }
+
+    bool running() const noexcept override
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        return m_exact? m_exact->running() : m_fast.running() || ( m_fast_done && !m_result_ready );
+    }
+
+    bool finished() const noexcept override
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        return m_result_ready;
+    }
+
+    // the overflow of the fast calculation isn't an error, the rest of the expression is still needed
+    bool error_occured() const noexcept override
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        return m_retry_failed || ( m_exact? m_exact->error_occured() :
+                                            m_fast_done && m_fast.error_occured() && !m_fast.overflowed() );
+    }
+
+    void abort() override
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_aborted = true;
+        m_fast.abort();
+
+        if( m_exact )
+        {
+            m_exact->abort();
+        }
+    }
+
+    void reset() override
+    {
+        std::unique_ptr< calc_handle< exact_type > > exact;
+
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            exact = std::move( m_exact );
+            m_started = false;
+            m_aborted = false;
+            m_fast_done = false;
+            m_retry_failed = false;
+            m_result_ready = false;
+            m_buffer.clear();
+            m_spill.reset();
+            m_spill_error.clear();
+            m_last_char = 0;
+            m_result.clear();
+            m_result_handler = nullptr;
+        }
+
+        // waits for its calculation, which takes the lock on completion
+        exact.reset();
+        m_fast.reset();
+    }
+
+    std::string get_result() override
+    {
+        std::unique_lock< std::mutex > l{ m_mutex };
+        if( !m_started )
+        {
+            return m_fast.get_result();
+        }
+
+        m_cv.wait( l, [ this ](){ return m_result_ready; } );
+        return m_result;
+    }
+
+    void async_get_result( result_handler handler ) override
+    {
+        assert( handler );
+
+        std::unique_lock< std::mutex > l{ m_mutex };
+        if( !m_started || m_result_ready )
+        {
+            std::string result{ m_started? m_result : m_fast.get_result() };
+            l.unlock();
+
+            handler( std::move( result ) );
+        }
+        else
+        {
+            m_result_handler = std::move( handler );
+        }
+    }
+
+    // The retry isn't counted, the data is received by then
+    void set_ingest_limiter( ingest_limiter* limiter ) override
+    {
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            m_limiter = limiter;
+        }
+
+        m_fast.set_ingest_limiter( limiter );
+    }
+
+private:
+    // Should be called with m_mutex locked. A failure to spill is reported only if the retry is needed
+    void buffer_part( const char* data, uint64_t size )
+    {
+        if( size )
+        {
+            m_last_char = data[ size - 1 ];
+        }
+
+        if( !m_spill && m_spill_error.empty() && m_buffer.size() + size <= m_retry_buffer_size )
+        {
+            m_buffer.append( data, size );
+            return;
+        }
+
+        try
+        {
+            if( m_spill_error.empty() )
+            {
+                if( !m_spill )
+                {
+                    m_spill.reset( new spill_file{ spill_directory() } );
+                }
+
+                m_spill->append( data, size );
+            }
+        }
+        catch( const std::exception& e )
+        {
+            m_spill_error = e.what();
+            m_spill.reset();
+        }
+    }
+
+    // Should be called with m_mutex locked
+    std::string spill_directory() const
+    {
+        if( m_limiter && !m_limiter->spill_directory().empty() )
+        {
+            return m_limiter->spill_directory();
+        }
+
+        const char* temp_directory{ std::getenv( "TMPDIR" ) };
+        return temp_directory? temp_directory : "/tmp";
+    }
+
+    // Called on the compute thread that has finished the fast calculation
+    // or right away if it was calculated inline
+    void on_fast_result( std::string result )
+    {
+        std::string buffer;
+        std::unique_ptr< spill_file > spill;
+        calc_handle< exact_type >* exact{ nullptr };
+        char last_char{ 0 };
+
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            m_fast_done = true;
+
+            if( m_fast.overflowed() && !m_aborted )
+            {
+                if( !m_spill_error.empty() )
+                {
+                    result = m_spill_error;
+                    m_retry_failed = true;
+                }
+                else
+                {
+                    buffer = std::move( m_buffer );
+                    spill = std::move( m_spill );
+                    last_char = m_last_char;
+
+                    m_exact.reset( new calc_handle< exact_type >{ m_inline_limit, m_memo_limit } );
+                    exact = m_exact.get();
+                }
+            }
+
+            m_buffer.clear();
+            m_spill.reset();
+        }
+
+        if( !exact )
+        {
+            publish_result( std::move( result ) );
+            return;
+        }
+
+        // the exact calculation may complete right away and take the lock
+        try
+        {
+            // a part bigger than the buffer is spilled whole, the calculation starts with its beginning
+            if( buffer.empty() && spill )
+            {
+                std::unique_ptr< mapped_file > window{ spill->map_unread() };
+                uint64_t size{ window->size() };
+
+                buffer.assign( window->data(), size );
+                window.reset();
+                spill->mark_read( size );
+
+                if( !spill->unread() )
+                {
+                    spill.reset();
+                }
+            }
+
+            exact->on_data( buffer.data(), buffer.size(), !spill );
+            buffer = std::string{};
+
+            // the rest is read from the spill file by the exact calculation itself
+            if( spill )
+            {
+                if( last_char != '\n' )
+                {
+                    spill->append( "\n", 1 ); // just in case to avoid unnecessary hanging
+                }
+
+                exact->on_spilled_data( std::move( spill ) );
+            }
+        }
+        catch( const std::exception& e )
+        {
+            exact->abort();
+            publish_result( e.what() );
+            return;
+        }
+
+        exact->async_get_result( std::bind( &fallback_calc_handle::publish_result, this, std::placeholders::_1 ) );
+    }
+
+    void publish_result( std::string result )
+    {
+        result_handler handler;
+
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            m_result = result;
+            m_result_ready = true;
+            handler = std::move( m_result_handler );
+            m_result_handler = nullptr;
+
+            m_cv.notify_all();
+        }
+
+        if( handler )
+        {
+            handler( std::move( result ) );
+        }
+    }
+
+private:
+    uint64_t m_inline_limit{ default_inline_limit };
+    std::size_t m_memo_limit{ 0 };
+    uint64_t m_retry_buffer_size{ default_retry_buffer_size };
+    ingest_limiter* m_limiter{ nullptr };
+
+    bool m_started{ false };
+    bool m_aborted{ false };
+    bool m_fast_done{ false };
+    bool m_retry_failed{ false };
+
+    // the expression kept for the retry: the beginning in memory, the rest in the file
+    std::string m_buffer;
+    std::unique_ptr< spill_file > m_spill;
+    std::string m_spill_error;
+    char m_last_char{ 0 };
+
+    bool m_result_ready{ false };
+    std::string m_result;
+    result_handler m_result_handler;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    // destroyed first: the calculations complete into the members above
+    std::unique_ptr< calc_handle< exact_type > > m_exact;
+    calc_handle< fast_type > m_fast;
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef GMP_INTEGER_H
+#define GMP_INTEGER_H
+
+#ifdef WITH_GMP
+
+#include <cstring>
+
+#include <gmpxx.h>
+
+#include "calculator.h"
+
+namespace calc
+{
+
+// GMP integer, the arithmetic of mpz_class already fits the calculator
+// and its division truncates towards zero like the built-in one
+using gmp_integer = mpz_class;
+
+// the strings are converted in place instead of going through the streams
+template<>
+struct number_traits< gmp_integer >
+{
+    static gmp_integer parse( const std::string& str )
+    {
+        gmp_integer value;
+        if( mpz_set_str( value.get_mpz_t(), str.c_str(), 10 ) )
+        {
+            throw std::invalid_argument{ "Invalid number" };
+        }
+
+        return value;
+    }
+
+    static std::string format( const gmp_integer& value )
+    {
+        // the size may exceed the actual length by one, plus the sign and the terminating zero
+        std::string str( mpz_sizeinbase( value.get_mpz_t(), 10 ) + 2, '\0' );
+        mpz_get_str( &str[ 0 ], 10, value.get_mpz_t() );
+        str.resize( std::strlen( str.c_str() ) );
+
+        return str;
+    }
+};
+
+// Unlike the BigInteger division, mpz_get_str() of GMP is subquadratic itself,
+// the values of more than a chunk of digits are split only to pass the leading digits early
+template<>
+struct progressive_format< gmp_integer >
+{
+    static void format( const gmp_integer& value, const std::function< void( std::string ) >& handler )
+    {
+        detail::halving_formatter< gmp_integer >{ handler, detail::format_chunk_size }.format( value );
+    }
+};
+
+} // calc
+
+#endif
+
+#endif
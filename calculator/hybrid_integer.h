@@ -0,0 +1,242 @@
+#ifndef HYBRID_INTEGER_H
+#define HYBRID_INTEGER_H
+
+#include <string>
+#include <limits>
+#include <cstdint>
+#include <iostream>
+
+#include "calculator.h"
+
+namespace calc
+{
+
+// Integer kept as a machine word while it fits, the math on two small values uses checked
+// instructions and the value is promoted to big_type only on overflow. big_type should be
+// an arbitrary precision integer constructible from int64_t and convertible by number_traits.
+// Promoted values stay big: checking whether they fit again would cost a comparison per operation
+template< typename big_type >
+class hybrid_integer
+{
+public:
+    hybrid_integer( int64_t value = 0 ) noexcept : m_value( value ){}
+    hybrid_integer( big_type value ) : m_small( false ), m_big( std::move( value ) ){}
+
+    bool is_small() const noexcept{ return m_small; }
+
+    hybrid_integer& operator+=( const hybrid_integer& other )
+    {
+        int64_t result{ 0 };
+        if( m_small && other.m_small && !__builtin_add_overflow( m_value, other.m_value, &result ) )
+        {
+            m_value = result;
+        }
+        else
+        {
+            big_type storage;
+            promote();
+            m_big += other.big( storage );
+        }
+
+        return *this;
+    }
+
+    hybrid_integer& operator-=( const hybrid_integer& other )
+    {
+        int64_t result{ 0 };
+        if( m_small && other.m_small && !__builtin_sub_overflow( m_value, other.m_value, &result ) )
+        {
+            m_value = result;
+        }
+        else
+        {
+            big_type storage;
+            promote();
+            m_big -= other.big( storage );
+        }
+
+        return *this;
+    }
+
+    hybrid_integer& operator*=( const hybrid_integer& other )
+    {
+        int64_t result{ 0 };
+        if( m_small && other.m_small && !__builtin_mul_overflow( m_value, other.m_value, &result ) )
+        {
+            m_value = result;
+        }
+        else
+        {
+            big_type storage;
+            promote();
+            m_big *= other.big( storage );
+        }
+
+        return *this;
+    }
+
+    // the only overflowing division is the minimal value by -1. The small values are rounded
+    // like the big ones, so the result doesn't depend on whether the values fit
+    hybrid_integer& operator/=( const hybrid_integer& other )
+    {
+        if( m_small && other.m_small &&
+            !( m_value == std::numeric_limits< int64_t >::min() && other.m_value == -1 ) )
+        {
+            int64_t quotient{ m_value / other.m_value };
+            if( floor_division() && m_value % other.m_value && ( m_value < 0 ) != ( other.m_value < 0 ) )
+            {
+                --quotient;
+            }
+
+            m_value = quotient;
+        }
+        else
+        {
+            big_type storage;
+            promote();
+            m_big /= other.big( storage );
+        }
+
+        return *this;
+    }
+
+    bool operator==( const hybrid_integer& other ) const
+    {
+        big_type storage;
+        big_type other_storage;
+
+        return m_small && other.m_small? m_value == other.m_value : big( storage ) == other.big( other_storage );
+    }
+
+    bool operator!=( const hybrid_integer& other ) const
+    {
+        return !( *this == other );
+    }
+
+    std::string to_string() const
+    {
+        return m_small? std::to_string( m_value ) : number_traits< big_type >::format( m_big );
+    }
+
+    // The big values are written by progressive_format of big_type
+    void to_chunks( const std::function< void( std::string ) >& handler ) const
+    {
+        if( m_small )
+        {
+            handler( std::to_string( m_value ) );
+        }
+        else
+        {
+            progressive_format< big_type >::format( m_big, handler );
+        }
+    }
+
+    // numbers of up to 18 digits always fit
+    static hybrid_integer parse( const std::string& str )
+    {
+        bool negative{ !str.empty() && str[ 0 ] == '-' };
+        std::size_t digits{ str.length() - ( negative? 1 : 0 ) };
+
+        if( !digits || digits > std::numeric_limits< int64_t >::digits10 )
+        {
+            return hybrid_integer{ number_traits< big_type >::parse( str ) };
+        }
+
+        int64_t small{ 0 };
+        for( std::size_t i{ negative? 1u : 0u }; i < str.length(); ++i )
+        {
+            if( str[ i ] < '0' || str[ i ] > '9' )
+            {
+                throw std::invalid_argument{ "Invalid number" };
+            }
+
+            small = small * 10 + ( str[ i ] - '0' );
+        }
+
+        return hybrid_integer{ negative? -small : small };
+    }
+
+    friend std::ostream& operator<<( std::ostream& os, const hybrid_integer& value )
+    {
+        return os << value.to_string();
+    }
+
+    friend std::istream& operator>>( std::istream& is, hybrid_integer& value )
+    {
+        std::string str;
+        if( is >> str )
+        {
+            value = parse( str );
+        }
+
+        return is;
+    }
+
+private:
+    // whether big_type rounds the quotient towards negative infinity(BigInteger does) instead of zero
+    static bool floor_division()
+    {
+        static const bool floors{ []()
+        {
+            big_type quotient( int64_t{ -7 } );
+            quotient /= big_type( int64_t{ 2 } );
+            return quotient == big_type( int64_t{ -4 } );
+        }() };
+
+        return floors;
+    }
+
+    void promote()
+    {
+        if( m_small )
+        {
+            m_big = big_type( m_value );
+            m_small = false;
+        }
+    }
+
+    // the big value, small ones are converted into the storage
+    const big_type& big( big_type& storage ) const
+    {
+        if( m_small )
+        {
+            storage = big_type( m_value );
+            return storage;
+        }
+
+        return m_big;
+    }
+
+private:
+    bool m_small{ true };
+    int64_t m_value{ 0 };
+    big_type m_big;
+};
+
+// the conversions bypass the streams
+template< typename big_type >
+struct number_traits< hybrid_integer< big_type > >
+{
+    static hybrid_integer< big_type > parse( const std::string& str )
+    {
+        return hybrid_integer< big_type >::parse( str );
+    }
+
+    static std::string format( const hybrid_integer< big_type >& value )
+    {
+        return value.to_string();
+    }
+};
+
+template< typename big_type >
+struct progressive_format< hybrid_integer< big_type > >
+{
+    static void format( const hybrid_integer< big_type >& value, const std::function< void( std::string ) >& handler )
+    {
+        value.to_chunks( handler );
+    }
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef INGEST_LIMITER_H
+#define INGEST_LIMITER_H
+
+#include <mutex>
+#include <string>
+#include <algorithm>
+#include <functional>
+
+namespace calc
+{
+
+// Reading pauses above this many received but not yet calculated bytes of a session
+static constexpr uint64_t default_high_watermark{ 16 << 20 };
+
+// Counts the bytes received by a session that wait in its calculators' queues.
+// Once they exceed the high watermark the session stops reading, so the client is slowed down
+// by TCP flow control, and resumes when the calculations have consumed them down to the low one.
+// With the spill directory the calculators write the data over the high watermark
+// to the temporary files instead, so the reading never pauses
+class ingest_limiter
+{
+public:
+    // high_watermark of 0 turns the limit off, the low one defaults to the half of it
+    explicit ingest_limiter( uint64_t high_watermark = default_high_watermark,
+                             uint64_t low_watermark = 0,
+                             std::string spill_directory = {} ) :
+        m_high_watermark( high_watermark ),
+        m_low_watermark( low_watermark? low_watermark : high_watermark / 2 ),
+        m_spill_directory( std::move( spill_directory ) ){}
+
+    ingest_limiter( const ingest_limiter& ) = delete;
+    ingest_limiter& operator=( const ingest_limiter& ) = delete;
+
+    void add( uint64_t size ) noexcept
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_buffered += size;
+    }
+
+    // Whether the part should go to the spill file instead of the memory
+    bool should_spill( uint64_t size ) const noexcept
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        return !m_spill_directory.empty() && m_high_watermark && m_buffered + size > m_high_watermark;
+    }
+
+    const std::string& spill_directory() const noexcept{ return m_spill_directory; }
+
+    // Called on the compute thread once the data is consumed or dropped
+    void release( uint64_t size )
+    {
+        std::function< void() > resume;
+
+        {
+            std::lock_guard< std::mutex > l{ m_mutex };
+            m_buffered -= std::min( size, m_buffered );
+
+            if( m_resume && m_buffered <= m_low_watermark )
+            {
+                resume = std::move( m_resume );
+                m_resume = nullptr;
+            }
+        }
+
+        if( resume )
+        {
+            resume();
+        }
+    }
+
+    // Returns true if the reading should pause, then resume is called once the data is consumed
+    bool pause_if_full( std::function< void() > resume )
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        if( !m_high_watermark || m_buffered <= m_high_watermark )
+        {
+            return false;
+        }
+
+        m_resume = std::move( resume );
+        return true;
+    }
+
+    uint64_t buffered() const noexcept
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        return m_buffered;
+    }
+
+private:
+    uint64_t m_high_watermark{ default_high_watermark };
+    uint64_t m_low_watermark{ default_high_watermark / 2 };
+    uint64_t m_buffered{ 0 };
+    std::function< void() > m_resume;
+    std::string m_spill_directory;
+
+    mutable std::mutex m_mutex;
+};
+
+} // calc
+
+#endif
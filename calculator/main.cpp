@@ -4,16 +4,40 @@
 #include <boost/program_options.hpp>
 
 #include "server.h"
-#include "calc_handle_factory.h"
+#include "disk_result_store.h"
+#include "mapped_file.h"
+#include "batch_calculator.h"
+#include "logger.h"
+#include "backend_registry.h"
+#include "hybrid_integer.h"
+#include "checked_integer.h"
+#include "gmp_integer.h"
+#include "decimal_integer.h"
 
-#include "big_int/BigIntegerUtils.hh"
+#include "big_integer_traits.h"
 
 static constexpr uint16_t default_port{ 6666 };
+static constexpr const char* default_backend{ "hybrid" };
+static constexpr uint64_t default_cache_size{ 64 << 20 };
 
 struct settings
 {
     uint16_t port{ default_port };
     uint32_t max_connections{ std::thread::hardware_concurrency() };
+    uint32_t compute_threads{ calc::executor::default_workers_num() };
+    uint32_t io_threads{ network::default_io_threads() };
+    bool reuse_port{ false };
+    uint64_t inline_limit{ calc::default_inline_limit };
+    std::size_t memo_limit{ 0 };
+    uint64_t cache_size{ default_cache_size };
+    std::string store_dir;
+    uint64_t store_size{ network::default_store_size };
+    uint64_t buffer_limit{ calc::default_high_watermark };
+    std::string spill_dir;
+    std::string file;
+    std::string batch;
+    std::string output;
+    std::string backend{ default_backend };
     bool only_show_help{ false };
 };
 
@@ -27,7 +51,35 @@ settings get_settings( int argc, char** argv )
             ( "help,h", "show usage" )
             ( "port,p", bpo::value( &s.port ), "server port, default = 6666" )
             ( "max_connections,c", bpo::value( &s.max_connections ),
-              "maximum connection, default = hardware concurrency" );
+              "maximum connection, default = hardware concurrency" )
+            ( "compute_threads,t", bpo::value( &s.compute_threads ),
+              "calculation threads shared by all connections, default = hardware concurrency" )
+            ( "io_threads,n", bpo::value( &s.io_threads ),
+              "threads reading and writing the connections, default = quarter of hardware concurrency" )
+            ( "reuse_port,e", "give every io thread its own io_service and SO_REUSEPORT acceptor" )
+            ( "inline_limit,i", bpo::value( &s.inline_limit ),
+              "max size of an expression received in one piece to be calculated on the io thread, default = 1024" )
+            ( "memo_limit,m", bpo::value( &s.memo_limit ),
+              "max size of a parenthesized subexpression calculated once per expression, default = 0(off)" )
+            ( "cache_size,r", bpo::value( &s.cache_size ),
+              "bytes of the results of the big expressions kept for the repeated ones, default = 64 MiB, 0 = off" )
+            ( "store_dir,d", bpo::value( &s.store_dir ),
+              "directory keeping the results of the big expressions between the runs, default = none(off)" )
+            ( "store_size,s", bpo::value( &s.store_size ),
+              "max bytes of the results kept in store_dir, default = 1 GiB" )
+            ( "buffer_limit,l", bpo::value( &s.buffer_limit ),
+              "bytes received by a connection and waiting for the calculation before its reading pauses, default = 16 MiB, 0 = unlimited" )
+            ( "spill_dir,u", bpo::value( &s.spill_dir ),
+              "directory for the temporary files keeping the received data over buffer_limit instead of pausing, default = none(off)" )
+            ( "file,f", bpo::value( &s.file ),
+              "calculate the expressions of the file, one per line, instead of starting the server" )
+            ( "batch,a", bpo::value( &s.batch ),
+              "calculate the files of the directory or matching the glob pattern on compute_threads threads, "
+              "instead of starting the server" )
+            ( "output,o", bpo::value( &s.output ),
+              "file for the results of --file or --batch, default = stdout" )
+            ( "backend,b", bpo::value( &s.backend ),
+              "number type(int64/int128/checked-int64/bigint/decimal/hybrid/fallback/gmp), default = hybrid" );
 
     bpo::variables_map map;
     bpo::store( bpo::parse_command_line( argc, argv, desc ), map );
@@ -48,13 +100,136 @@ settings get_settings( int argc, char** argv )
         {
             s.max_connections = map[ "max_connections" ].as< uint32_t >();
         }
+
+        if( map.count( "compute_threads" ) )
+        {
+            s.compute_threads = map[ "compute_threads" ].as< uint32_t >();
+        }
+
+        if( map.count( "io_threads" ) )
+        {
+            s.io_threads = map[ "io_threads" ].as< uint32_t >();
+        }
+
+        s.reuse_port = map.count( "reuse_port" ) > 0;
+
+        if( map.count( "inline_limit" ) )
+        {
+            s.inline_limit = map[ "inline_limit" ].as< uint64_t >();
+        }
+
+        if( map.count( "memo_limit" ) )
+        {
+            s.memo_limit = map[ "memo_limit" ].as< std::size_t >();
+        }
+
+        if( map.count( "cache_size" ) )
+        {
+            s.cache_size = map[ "cache_size" ].as< uint64_t >();
+        }
+
+        if( map.count( "store_dir" ) )
+        {
+            s.store_dir = map[ "store_dir" ].as< std::string >();
+        }
+
+        if( map.count( "store_size" ) )
+        {
+            s.store_size = map[ "store_size" ].as< uint64_t >();
+        }
+
+        if( map.count( "buffer_limit" ) )
+        {
+            s.buffer_limit = map[ "buffer_limit" ].as< uint64_t >();
+        }
+
+        if( map.count( "spill_dir" ) )
+        {
+            s.spill_dir = map[ "spill_dir" ].as< std::string >();
+        }
+
+        if( map.count( "file" ) )
+        {
+            s.file = map[ "file" ].as< std::string >();
+        }
+
+        if( map.count( "batch" ) )
+        {
+            s.batch = map[ "batch" ].as< std::string >();
+        }
+
+        if( map.count( "output" ) )
+        {
+            s.output = map[ "output" ].as< std::string >();
+        }
+
+        if( map.count( "backend" ) )
+        {
+            s.backend = map[ "backend" ].as< std::string >();
+        }
     }
 
     return s;
 }
 
+// int64 wraps around on overflow, the checked types report it, fallback recalculates the overflowed
+// expressions with hybrid, which keeps the numbers as int64 until they overflow and as BigInteger after
+void add_backends( calc::backend_registry& registry, uint64_t inline_limit, std::size_t memo_limit )
+{
+    using big_type = calc::hybrid_integer< BigInteger >;
+
+    registry.add( "hybrid", std::make_unique< calc::calc_handle_factory< big_type > >( inline_limit, memo_limit ) );
+    registry.add( "bigint", std::make_unique< calc::calc_handle_factory< BigInteger > >( inline_limit, memo_limit ) );
+    registry.add( "int64", std::make_unique< calc::calc_handle_factory< int64_t > >( inline_limit, memo_limit ) );
+    registry.add( "checked-int64", std::make_unique< calc::calc_handle_factory< calc::checked_int64 > >( inline_limit, memo_limit ) );
+    registry.add( "int128", std::make_unique< calc::calc_handle_factory< calc::checked_int128 > >( inline_limit, memo_limit ) );
+    registry.add( "decimal", std::make_unique< calc::calc_handle_factory< calc::decimal_integer > >( inline_limit, memo_limit ) );
+    registry.add( "fallback", std::make_unique< calc::fallback_calc_handle_factory< calc::floored_checked_int64, big_type > >( inline_limit, memo_limit ) );
+
+#ifdef WITH_GMP
+    registry.add( "gmp", std::make_unique< calc::calc_handle_factory< calc::gmp_integer > >( inline_limit, memo_limit ) );
+#endif
+}
+
+// The mapped file is calculated in place: no socket, no queue of the received parts
+void calculate_file( const calc::abstract_calc_handle_factory& backends, const std::string& path, std::ostream& out )
+{
+    calc::mapped_file file{ path };
+
+#ifdef SHOW_TIME
+    auto start = std::chrono::high_resolution_clock::now();
+#endif
+
+    calc::calculate_lines( backends, file.data(), file.size(), [ &out ]( std::string result )
+    {
+        out << result << '\n';
+    } );
+
+    out.flush();
+
+#ifdef SHOW_TIME
+    auto finish = std::chrono::high_resolution_clock::now();
+    uint64_t msec = std::chrono::duration_cast< std::chrono::milliseconds >( finish - start ).count();
+    logger::log( "Calculated " + std::to_string( file.size() ) + " bytes in " + std::to_string( msec ), logger::to::cerr );
+#endif
+}
+
 #include <queue>
 
+// Runs the server till SIGINT or SIGTERM
+template< typename server_type >
+void serve( server_type& server, boost::asio::io_service& io_service )
+{
+    boost::asio::signal_set signals_to_handle{ io_service, SIGINT, SIGTERM };
+    signals_to_handle.async_wait( [ & ]( const boost::system::error_code&, int )
+    {
+        server.stop();
+        io_service.stop();
+    } );
+
+    server.start();
+}
+
 int main( int argc, char *argv[] )
 {
     try
@@ -65,20 +240,66 @@ int main( int argc, char *argv[] )
             return 0;
         }
 
+        calc::executor::set_instance_workers_num( s.compute_threads );
+
         boost::asio::io_service io_service;
-        calc::calc_handle_factory< BigInteger > factory;
-        network::tcp_calc_server server{ factory, io_service, s.port, s.max_connections };
+        calc::backend_registry backends;
+        add_backends( backends, s.inline_limit, s.memo_limit );
+        backends.set_default( s.backend );
 
-        boost::asio::signal_set signals_to_handle{ io_service, SIGINT, SIGTERM };
-        signals_to_handle.async_wait( [ & ]( const boost::system::error_code&, int )
+        if( !s.file.empty() || !s.batch.empty() )
         {
-            server.stop();
-            io_service.stop();
-        } );
+            std::ofstream output_file;
+            if( !s.output.empty() )
+            {
+                output_file.open( s.output, std::ios::binary | std::ios::trunc );
+                if( !output_file )
+                {
+                    throw std::ios_base::failure{ "Failed to open file: " + s.output };
+                }
+            }
+
+            std::ostream& out = s.output.empty()? std::cout : output_file;
+            if( !s.file.empty() )
+            {
+                calculate_file( backends, s.file, out );
+            }
+            else
+            {
+                calc::batch_calculator batch{ backends, s.compute_threads };
+                batch.calculate( calc::batch_calculator::find_files( s.batch ), out );
+            }
+
+            return 0;
+        }
+
+        std::unique_ptr< network::disk_result_store > store;
+        if( !s.store_dir.empty() )
+        {
+            store = std::make_unique< network::disk_result_store >( s.store_dir, s.store_size );
+        }
 
         std::cout << "Listening to port " << s.port << std::endl;
 
-        server.start();
+        network::server_settings server_settings;
+        server_settings.port = s.port;
+        server_settings.max_sessions = s.max_connections;
+        server_settings.cache_size = s.cache_size;
+        server_settings.store = store.get();
+        server_settings.high_watermark = s.buffer_limit;
+        server_settings.spill_directory = s.spill_dir;
+        server_settings.io_threads = s.io_threads;
+
+        if( s.reuse_port )
+        {
+            network::reuse_port_calc_server server{ backends, io_service, server_settings };
+            serve( server, io_service );
+        }
+        else
+        {
+            network::tcp_calc_server server{ backends, io_service, server_settings };
+            serve( server, io_service );
+        }
     }
     catch( const calc::calculation_aborted& )
     {
@@ -0,0 +1,81 @@
+#include "mapped_file.h"
+
+#include <ios>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace calc
+{
+
+mapped_file::mapped_file( const std::string& path )
+{
+    int fd{ ::open( path.c_str(), O_RDONLY ) };
+    if( fd < 0 )
+    {
+        throw std::ios_base::failure{ "Failed to open file: " + path };
+    }
+
+    struct stat info;
+    if( ::fstat( fd, &info ) != 0 )
+    {
+        ::close( fd );
+        throw std::ios_base::failure{ "Failed to read file size: " + path };
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    if( !map( fd, 0, static_cast< uint64_t >( info.st_size ) ) )
+    {
+        ::close( fd );
+        throw std::ios_base::failure{ "Failed to map file: " + path };
+    }
+
+    ::close( fd );
+}
+
+mapped_file::mapped_file( int fd, uint64_t offset, uint64_t size )
+{
+    if( !map( fd, offset, size ) )
+    {
+        throw std::ios_base::failure{ "Failed to map file region" };
+    }
+}
+
+mapped_file::~mapped_file()
+{
+    if( m_mapping )
+    {
+        ::munmap( m_mapping, m_mapping_size );
+    }
+}
+
+bool mapped_file::map( int fd, uint64_t offset, uint64_t size ) noexcept
+{
+    if( !size )
+    {
+        return true;
+    }
+
+    static const uint64_t page_size{ static_cast< uint64_t >( ::sysconf( _SC_PAGESIZE ) ) };
+    uint64_t page_offset{ offset % page_size };
+
+    void* mapping{ ::mmap( nullptr, size + page_offset, PROT_READ, MAP_PRIVATE, fd,
+                           static_cast< off_t >( offset - page_offset ) ) };
+    if( mapping == MAP_FAILED )
+    {
+        return false;
+    }
+
+    m_mapping = mapping;
+    m_mapping_size = size + page_offset;
+    m_data = static_cast< const char* >( mapping ) + page_offset;
+    m_size = size;
+
+    ::madvise( m_mapping, m_mapping_size, MADV_SEQUENTIAL );
+
+    return true;
+}
+
+} // calc
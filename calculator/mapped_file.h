@@ -0,0 +1,41 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstdint>
+
+namespace calc
+{
+
+// Read-only memory mapping of a whole file or of its region, the pages are read on demand by the kernel
+class mapped_file
+{
+public:
+    explicit mapped_file( const std::string& path );
+
+    // The region of the open file, the descriptor stays owned by the caller
+    mapped_file( int fd, uint64_t offset, uint64_t size );
+    ~mapped_file();
+
+    mapped_file( const mapped_file& ) = delete;
+    mapped_file& operator=( const mapped_file& ) = delete;
+
+    // nullptr for an empty file
+    const char* data() const noexcept{ return m_data; }
+    uint64_t size() const noexcept{ return m_size; }
+
+private:
+    bool map( int fd, uint64_t offset, uint64_t size ) noexcept;
+
+private:
+    const char* m_data{ nullptr };
+    uint64_t m_size{ 0 };
+
+    // the mapping starts at the page boundary before the data
+    void* m_mapping{ nullptr };
+    uint64_t m_mapping_size{ 0 };
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,213 @@
+#include "parallel_calculator.h"
+
+namespace calc
+{
+
+namespace detail
+{
+
+// Term of a sum or factor of a product, oper joins it to the previous ones
+struct piece
+{
+    const char* begin;
+    const char* end;
+    operator_type oper;
+};
+
+static bool is_space( char c ) noexcept
+{
+    return c == ' ';
+}
+
+static void trim( const char*& begin, const char*& end ) noexcept
+{
+    while( begin != end && is_space( *begin ) )
+    {
+        ++begin;
+    }
+
+    while( begin != end && is_space( *( end - 1 ) ) )
+    {
+        --end;
+    }
+}
+
+static split_node make_leaf( const char* begin, const char* end, bool is_signed )
+{
+    split_node leaf;
+    leaf.begin = begin;
+    leaf.end = end;
+    leaf.is_signed = is_signed;
+
+    return leaf;
+}
+
+// Splits the span at the top level operators of the given precedence. A sign is an operator
+// only after an operand, otherwise it is a part of a negative number
+static std::vector< piece > split_pieces( const char* begin, const char* end, int precedence,
+                                          const bracket_index& index )
+{
+    std::vector< piece > pieces;
+    const char* piece_begin{ begin };
+    operator_type piece_oper{ precedence == 1? operator_type::addition : operator_type::multiplication };
+
+    char last{ '\0' };
+
+    for( const char* it{ begin }; it != end; ++it )
+    {
+        char c{ *it };
+        if( c == '(' )
+        {
+            // groups are stepped over, their closing bracket is the last character
+            it = index.closing( it );
+            c = ')';
+        }
+        else if( ( c == '+' || c == '-' || c == '*' || c == '/' ) &&
+                 ( ( last >= '0' && last <= '9' ) || last == ')' ) )
+        {
+            operator_type oper{ get_oper_type( c ) };
+            if( get_precedence( oper ) == precedence )
+            {
+                pieces.push_back( piece{ piece_begin, it, piece_oper } );
+                piece_begin = it + 1;
+                piece_oper = oper;
+            }
+        }
+
+        if( !is_space( c ) )
+        {
+            last = c;
+        }
+    }
+
+    pieces.push_back( piece{ piece_begin, end, piece_oper } );
+    return pieces;
+}
+
+static std::size_t size( const piece& p ) noexcept
+{
+    return p.end - p.begin;
+}
+
+static split_node plan_sum( const std::vector< piece >& terms, std::size_t min_task_size,
+                            const bracket_index& index );
+static split_node plan_product( const std::vector< piece >& factors, std::size_t min_task_size,
+                                const bracket_index& index );
+
+split_node plan_split( const char* begin, const char* end, std::size_t min_task_size,
+                       const bracket_index& index )
+{
+    trim( begin, end );
+
+    if( static_cast< std::size_t >( end - begin ) < 2 * min_task_size || !index.valid() )
+    {
+        return make_leaf( begin, end, false );
+    }
+
+    if( *begin == '(' && index.closing( begin ) == end - 1 )
+    {
+        return plan_split( begin + 1, end - 1, min_task_size, index );
+    }
+
+    std::vector< piece > terms{ split_pieces( begin, end, 1, index ) };
+    if( terms.size() > 1 )
+    {
+        return plan_sum( terms, min_task_size, index );
+    }
+
+    std::vector< piece > factors{ split_pieces( begin, end, 2, index ) };
+    if( factors.size() > 1 )
+    {
+        return plan_product( factors, min_task_size, index );
+    }
+
+    return make_leaf( begin, end, false );
+}
+
+static split_node finish_node( split_node node )
+{
+    if( node.children.size() == 1 )
+    {
+        // the operator of the only child is the implicit addition of the first one
+        return std::move( node.children.front() );
+    }
+
+    return node;
+}
+
+// Big terms are split further, consecutive small ones are calculated together.
+// A group keeps the sign of its first term and is added to the sum
+static split_node plan_sum( const std::vector< piece >& terms, std::size_t min_task_size,
+                            const bracket_index& index )
+{
+    split_node node;
+    node.node_kind = split_node::kind::sum;
+
+    for( std::size_t i{ 0 }; i < terms.size(); )
+    {
+        if( size( terms[ i ] ) >= min_task_size )
+        {
+            node.children.push_back( plan_split( terms[ i ].begin, terms[ i ].end, min_task_size, index ) );
+            node.operators.push_back( terms[ i ].oper );
+            ++i;
+            continue;
+        }
+
+        // the sign of the group is the character before its first term
+        const char* group_begin{ i? terms[ i ].begin - 1 : terms[ i ].begin };
+        const char* group_end{ terms[ i ].end };
+
+        for( ++i; i < terms.size() && size( terms[ i ] ) < min_task_size &&
+                  static_cast< std::size_t >( group_end - group_begin ) < min_task_size; ++i )
+        {
+            group_end = terms[ i ].end;
+        }
+
+        node.children.push_back( make_leaf( group_begin, group_end, group_begin != terms.front().begin ) );
+        node.operators.push_back( operator_type::addition );
+    }
+
+    return finish_node( std::move( node ) );
+}
+
+// Products are calculated left to right, so only the leading factors can be grouped with
+// any operators, the later groups are runs of multiplications: a * ( b * c ) == a * b * c
+static split_node plan_product( const std::vector< piece >& factors, std::size_t min_task_size,
+                                const bracket_index& index )
+{
+    split_node node;
+    node.node_kind = split_node::kind::product;
+
+    for( std::size_t i{ 0 }; i < factors.size(); )
+    {
+        if( size( factors[ i ] ) >= min_task_size )
+        {
+            node.children.push_back( plan_split( factors[ i ].begin, factors[ i ].end, min_task_size, index ) );
+            node.operators.push_back( factors[ i ].oper );
+            ++i;
+            continue;
+        }
+
+        bool prefix{ i == 0 };
+        operator_type oper{ factors[ i ].oper };
+        const char* group_begin{ factors[ i ].begin };
+        const char* group_end{ factors[ i ].end };
+
+        for( ++i; i < factors.size() && size( factors[ i ] ) < min_task_size &&
+                  static_cast< std::size_t >( group_end - group_begin ) < min_task_size &&
+                  ( prefix || ( oper == operator_type::multiplication &&
+                                factors[ i ].oper == operator_type::multiplication ) ); ++i )
+        {
+            group_end = factors[ i ].end;
+        }
+
+        node.children.push_back( make_leaf( group_begin, group_end, false ) );
+        node.operators.push_back( oper );
+    }
+
+    return finish_node( std::move( node ) );
+}
+
+}// detail
+
+}// calc
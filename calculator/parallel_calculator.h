@@ -0,0 +1,215 @@
+#ifndef PARALLEL_CALCULATOR_H
+#define PARALLEL_CALCULATOR_H
+
+#include <vector>
+#include <algorithm>
+#include <exception>
+
+#include "calculator.h"
+#include "bracket_index.h"
+
+namespace calc
+{
+
+namespace detail
+{
+
+// Plan of the parallel calculation. Leaves are the parts of the text calculated
+// sequentially, sums and products combine the values of their children in order
+struct split_node
+{
+    enum class kind{ leaf, sum, product };
+
+    kind node_kind{ kind::leaf };
+
+    // leaf only, signed leaves start with the sign of the term that was split off
+    const char* begin{ nullptr };
+    const char* end{ nullptr };
+    bool is_signed{ false };
+    std::size_t leaf_index{ 0 };
+
+    // operators[ i ] combines the value of children[ i ] with the value of the previous ones
+    std::vector< operator_type > operators;
+    std::vector< split_node > children;
+};
+
+// Splits the expression into independent top-level terms and factors of at least min_task_size
+// bytes, descending into the big parenthesized groups found by the index. Returns a single leaf
+// if the expression can't be split, invalid brackets included: the sequential calculation reports the error
+split_node plan_split( const char* begin, const char* end, std::size_t min_task_size,
+                       const bracket_index& index );
+
+}// detail
+
+static constexpr std::size_t default_min_task_size{ 1 << 20 };
+
+// Calculates the expression that is already in memory(file, fully received request)
+// splitting it into independent subexpressions calculated concurrently on the executor.
+// The calling thread waits for the result, so it shouldn't be a worker of the same executor
+template< typename type >
+class parallel_calculator
+{
+public:
+    explicit parallel_calculator( executor& exec = executor::instance(),
+                                  std::size_t min_task_size = default_min_task_size ) :
+        m_executor( exec ),
+        m_min_task_size( std::max< std::size_t >( min_task_size, 1 ) ){}
+
+    // The expression ends with the first newline or with the data
+    type calculate( const char* data, std::size_t size )
+    {
+        assert( data );
+
+        const char* end{ std::find_if( data, data + size, []( char c ){ return c == '\n' || c == '\r'; } ) };
+        if( static_cast< std::size_t >( end - data ) < 2 * m_min_task_size )
+        {
+            // too small to split, plain streaming calculation
+            detail::split_node leaf;
+            leaf.begin = data;
+            leaf.end = end;
+
+            return calculate_leaf( leaf );
+        }
+
+        bracket_index index{ data, end, m_min_task_size, m_executor };
+        detail::split_node plan{ detail::plan_split( data, end, m_min_task_size, index ) };
+
+        std::vector< const detail::split_node* > leaves;
+        collect_leaves( plan, leaves );
+
+        if( leaves.size() == 1 )
+        {
+            return calculate_leaf( *leaves.front() );
+        }
+
+        calculate_leaves( leaves );
+        return combine( plan );
+    }
+
+private:
+    void collect_leaves( detail::split_node& node, std::vector< const detail::split_node* >& leaves )
+    {
+        if( node.node_kind == detail::split_node::kind::leaf )
+        {
+            node.leaf_index = leaves.size();
+            leaves.push_back( &node );
+        }
+        else
+        {
+            for( auto& child : node.children )
+            {
+                collect_leaves( child, leaves );
+            }
+        }
+    }
+
+    static type calculate_leaf( const detail::split_node& leaf )
+    {
+        expression_evaluator< type > evaluator;
+
+        // the split off term keeps its sign: "- a * b" is calculated as "0 - a * b"
+        if( leaf.is_signed )
+        {
+            evaluator.consume( "0", 1 );
+        }
+
+        evaluator.consume( leaf.begin, leaf.end - leaf.begin );
+        evaluator.consume( "\n", 1 );
+
+        return evaluator.result();
+    }
+
+    void calculate_leaves( const std::vector< const detail::split_node* >& leaves )
+    {
+        m_values.assign( leaves.size(), type{} );
+
+        // the biggest leaves go first to even out the workers' load
+        std::vector< std::size_t > order( leaves.size() );
+        for( std::size_t i{ 0 }; i < order.size(); ++i )
+        {
+            order[ i ] = i;
+        }
+
+        std::sort( order.begin(), order.end(), [ & ]( std::size_t l, std::size_t r )
+        {
+            return ( leaves[ l ]->end - leaves[ l ]->begin ) > ( leaves[ r ]->end - leaves[ r ]->begin );
+        } );
+
+        m_errors.assign( leaves.size(), nullptr );
+        m_executor.run_parallel( order.size(), [ & ]( std::size_t i )
+        {
+            std::size_t index{ order[ i ] };
+
+            try
+            {
+                m_values[ index ] = calculate_leaf( *leaves[ index ] );
+            }
+            catch( ... )
+            {
+                m_errors[ index ] = std::current_exception();
+            }
+        } );
+    }
+
+    // The errors are rethrown in the order of the expression. A factor multiplied by zero
+    // is skipped like in the sequential calculation: only its syntax errors are reported
+    type combine( const detail::split_node& node, bool skipped = false )
+    {
+        if( node.node_kind == detail::split_node::kind::leaf )
+        {
+            if( skipped )
+            {
+                validate_leaf( node );
+                return type{ 0 };
+            }
+
+            if( m_errors[ node.leaf_index ] )
+            {
+                std::rethrow_exception( m_errors[ node.leaf_index ] );
+            }
+
+            return std::move( m_values[ node.leaf_index ] );
+        }
+
+        type result{ combine( node.children.front(), skipped ) };
+        for( std::size_t i{ 1 }; i < node.children.size(); ++i )
+        {
+            bool skip_child{ skipped || ( node.operators[ i ] == detail::operator_type::multiplication && result == type{ 0 } ) };
+            type value{ combine( node.children[ i ], skip_child ) };
+
+            if( !skipped )
+            {
+                result = detail::calc_math( result, value, node.operators[ i ] );
+            }
+        }
+
+        return result;
+    }
+
+    // The failed leaf is recalculated as a skipped factor to tell the syntax errors from the math ones
+    void validate_leaf( const detail::split_node& leaf )
+    {
+        if( !m_errors[ leaf.leaf_index ] )
+        {
+            return;
+        }
+
+        expression_evaluator< type > evaluator;
+        evaluator.consume( leaf.is_signed? "0 * ( 0" : "0 * (", leaf.is_signed? 7 : 5 );
+        evaluator.consume( leaf.begin, leaf.end - leaf.begin );
+        evaluator.consume( " )\n", 3 );
+
+        evaluator.result();
+    }
+
+private:
+    executor& m_executor;
+    std::size_t m_min_task_size{ default_min_task_size };
+
+    std::vector< type > m_values;
+    std::vector< std::exception_ptr > m_errors;
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,237 @@
+#include "result_cache.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include "disk_result_store.h"
+
+namespace network
+{
+
+static const uint32_t round_constants[ 64 ]
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotate_right( uint32_t value, int bits ) noexcept
+{
+    return ( value >> bits ) | ( value << ( 32 - bits ) );
+}
+
+void content_hash::update( const char* data, uint64_t size ) noexcept
+{
+    m_length += size;
+
+    // complete the block started by the previous part
+    if( m_block_size )
+    {
+        uint64_t missing{ std::min( size, block_size - m_block_size ) };
+        std::memcpy( m_block + m_block_size, data, missing );
+        m_block_size += missing;
+        data += missing;
+        size -= missing;
+
+        if( m_block_size < block_size )
+        {
+            return;
+        }
+
+        compress( m_block );
+        m_block_size = 0;
+    }
+
+    for( ; size >= block_size; data += block_size, size -= block_size )
+    {
+        compress( reinterpret_cast< const unsigned char* >( data ) );
+    }
+
+    std::memcpy( m_block, data, size );
+    m_block_size = size;
+}
+
+content_key content_hash::digest() const noexcept
+{
+    // 0x80, the zeroes up to 8 bytes before the end of a block and the length in bits, big endian
+    unsigned char padding[ block_size + 8 ]{ 0x80 };
+    uint64_t padding_size{ ( m_block_size < block_size - 8? block_size : 2 * block_size ) - m_block_size };
+
+    uint64_t bits{ m_length * 8 };
+    for( uint64_t i{ 0 }; i < 8; ++i )
+    {
+        padding[ padding_size - 1 - i ] = static_cast< unsigned char >( bits >> ( 8 * i ) );
+    }
+
+    content_hash final_state{ *this };
+    final_state.update( reinterpret_cast< const char* >( padding ), padding_size );
+
+    content_key key;
+    for( std::size_t i{ 0 }; i < key.digest.size(); ++i )
+    {
+        key.digest[ i ] = static_cast< uint64_t >( final_state.m_state[ 2 * i ] ) << 32 | final_state.m_state[ 2 * i + 1 ];
+    }
+
+    key.size = m_length;
+
+    return key;
+}
+
+void content_hash::compress( const unsigned char* block ) noexcept
+{
+    uint32_t schedule[ 64 ];
+    for( int i{ 0 }; i < 16; ++i )
+    {
+        schedule[ i ] = static_cast< uint32_t >( block[ 4 * i ] ) << 24 | static_cast< uint32_t >( block[ 4 * i + 1 ] ) << 16 |
+                        static_cast< uint32_t >( block[ 4 * i + 2 ] ) << 8 | static_cast< uint32_t >( block[ 4 * i + 3 ] );
+    }
+
+    for( int i{ 16 }; i < 64; ++i )
+    {
+        uint32_t s0{ rotate_right( schedule[ i - 15 ], 7 ) ^ rotate_right( schedule[ i - 15 ], 18 ) ^ ( schedule[ i - 15 ] >> 3 ) };
+        uint32_t s1{ rotate_right( schedule[ i - 2 ], 17 ) ^ rotate_right( schedule[ i - 2 ], 19 ) ^ ( schedule[ i - 2 ] >> 10 ) };
+        schedule[ i ] = schedule[ i - 16 ] + s0 + schedule[ i - 7 ] + s1;
+    }
+
+    uint32_t a{ m_state[ 0 ] }, b{ m_state[ 1 ] }, c{ m_state[ 2 ] }, d{ m_state[ 3 ] };
+    uint32_t e{ m_state[ 4 ] }, f{ m_state[ 5 ] }, g{ m_state[ 6 ] }, h{ m_state[ 7 ] };
+
+    for( int i{ 0 }; i < 64; ++i )
+    {
+        uint32_t s1{ rotate_right( e, 6 ) ^ rotate_right( e, 11 ) ^ rotate_right( e, 25 ) };
+        uint32_t choice{ ( e & f ) ^ ( ~e & g ) };
+        uint32_t temp1{ h + s1 + choice + round_constants[ i ] + schedule[ i ] };
+        uint32_t s0{ rotate_right( a, 2 ) ^ rotate_right( a, 13 ) ^ rotate_right( a, 22 ) };
+        uint32_t majority{ ( a & b ) ^ ( a & c ) ^ ( b & c ) };
+        uint32_t temp2{ s0 + majority };
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    m_state[ 0 ] += a;
+    m_state[ 1 ] += b;
+    m_state[ 2 ] += c;
+    m_state[ 3 ] += d;
+    m_state[ 4 ] += e;
+    m_state[ 5 ] += f;
+    m_state[ 6 ] += g;
+    m_state[ 7 ] += h;
+}
+
+result_cache::result_cache( uint64_t max_size, uint64_t min_expression_size, disk_result_store* store ) noexcept :
+    m_max_size( max_size ),
+    m_min_expression_size( min_expression_size ),
+    m_store( store ){}
+
+bool result_cache::find_or_wait( const content_key& key, wait_handler handler )
+{
+    std::string result;
+    bool cached{ false };
+
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+
+        auto found = m_index.find( key );
+        if( found != m_index.end() )
+        {
+            m_entries.splice( m_entries.begin(), m_entries, found->second );
+            result = found->second->result;
+            cached = true;
+        }
+        else
+        {
+            auto flight = m_in_flight.find( key );
+            if( flight != m_in_flight.end() )
+            {
+                flight->second.push_back( std::move( handler ) );
+                return true;
+            }
+
+            m_in_flight[ key ];
+        }
+    }
+
+    // the same expressions wait in the flight while the file is read
+    if( !cached )
+    {
+        if( !m_store || !m_store->load( key, result ) )
+        {
+            return false;
+        }
+
+        add_result( key, result, true );
+    }
+
+    handler( std::move( result ), true );
+    return true;
+}
+
+void result_cache::complete( const content_key& key, const std::string& result, bool cacheable )
+{
+    if( cacheable && m_store )
+    {
+        m_store->save( key, result );
+    }
+
+    add_result( key, result, cacheable );
+}
+
+void result_cache::add_result( const content_key& key, const std::string& result, bool cacheable )
+{
+    std::vector< wait_handler > waiting;
+
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+
+        auto flight = m_in_flight.find( key );
+        if( flight != m_in_flight.end() )
+        {
+            waiting = std::move( flight->second );
+            m_in_flight.erase( flight );
+        }
+
+        if( cacheable && m_index.find( key ) == m_index.end() )
+        {
+            m_entries.push_front( entry{ key, result } );
+            m_index[ key ] = m_entries.begin();
+            m_size += entry_size( m_entries.front() );
+
+            evict();
+        }
+    }
+
+    for( auto& handler : waiting )
+    {
+        handler( cacheable? result : std::string{}, cacheable );
+    }
+}
+
+// Should be called with m_mutex locked, a result bigger than the budget is dropped right away
+void result_cache::evict() noexcept
+{
+    while( m_size > m_max_size && !m_entries.empty() )
+    {
+        m_size -= entry_size( m_entries.back() );
+        m_index.erase( m_entries.back().key );
+        m_entries.pop_back();
+    }
+}
+
+uint64_t result_cache::entry_size( const entry& e ) noexcept
+{
+    return sizeof( entry ) + e.result.capacity();
+}
+
+}// network
@@ -0,0 +1,119 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <list>
+#include <array>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+#include "calc_handle.h"
+
+namespace network
+{
+
+// Expressions shorter than this are calculated faster than they are looked up
+static constexpr uint64_t default_min_cached_size{ 4096 };
+
+// The SHA-256 digest of the text as big endian words and the length of the text
+struct content_key
+{
+    std::array< uint64_t, 4 > digest{ { 0, 0, 0, 0 } };
+    uint64_t size{ 0 };
+
+    bool operator==( const content_key& other ) const noexcept
+    {
+        return digest == other.digest && size == other.size;
+    }
+};
+
+struct content_key_hash
+{
+    std::size_t operator()( const content_key& key ) const noexcept
+    {
+        return static_cast< std::size_t >( key.digest[ 0 ] );
+    }
+};
+
+// SHA-256 of the text received in parts, each part is hashed once as it arrives, so the key
+// is ready right after the end of the expression. The results are shared between the clients
+// and kept between the runs by the key alone, so it should be collision resistant
+class content_hash
+{
+public:
+    void update( const char* data, uint64_t size ) noexcept;
+    content_key digest() const noexcept;
+
+private:
+    static constexpr uint64_t block_size{ 64 };
+
+    void compress( const unsigned char* block ) noexcept;
+
+private:
+    uint32_t m_state[ 8 ]{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                           0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    uint64_t m_length{ 0 };
+
+    // the bytes of the last incomplete block
+    unsigned char m_block[ block_size ]{};
+    uint64_t m_block_size{ 0 };
+};
+
+class disk_result_store;
+
+// Gets the result of the same expression calculated by another session, or found false
+// if that calculation has failed or was aborted, then the waiting one should calculate it itself
+using wait_handler = std::function< void( std::string result, bool found ) >;
+
+// Results of the recently calculated expressions shared by all the sessions of the server,
+// the least recently used are dropped once their size exceeds the budget.
+// Identical expressions that arrive while the first one is being calculated wait for its result.
+// With the store the results missing in memory are looked up on disk, the new ones are saved there too
+class result_cache
+{
+public:
+    explicit result_cache( uint64_t max_size,
+                           uint64_t min_expression_size = default_min_cached_size,
+                           disk_result_store* store = nullptr ) noexcept;
+
+    uint64_t min_expression_size() const noexcept{ return m_min_expression_size; }
+
+    // Returns false if the expression should be calculated by the caller, who then reports
+    // the result with complete(). Otherwise the handler is called: right away if the result
+    // is cached or once the calculation of the same expression is complete
+    bool find_or_wait( const content_key& key, wait_handler handler );
+
+    // Only the successful results are cached, stored and passed to the waiting handlers.
+    // The others release the waiting handlers to calculate the expression themselves
+    void complete( const content_key& key, const std::string& result, bool cacheable );
+
+private:
+    struct entry
+    {
+        content_key key;
+        std::string result;
+    };
+
+    void add_result( const content_key& key, const std::string& result, bool cacheable );
+    void evict() noexcept;
+    static uint64_t entry_size( const entry& e ) noexcept;
+
+private:
+    uint64_t m_max_size{ 0 };
+    uint64_t m_min_expression_size{ default_min_cached_size };
+    uint64_t m_size{ 0 };
+    disk_result_store* m_store{ nullptr };
+
+    // the most recently used first
+    std::list< entry > m_entries;
+    std::unordered_map< content_key, std::list< entry >::iterator, content_key_hash > m_index;
+
+    // the handlers waiting for the expressions being calculated
+    std::unordered_map< content_key, std::vector< wait_handler >, content_key_hash > m_in_flight;
+
+    std::mutex m_mutex;
+};
+
+}// network
+
+#endif
@@ -0,0 +1,96 @@
+#include "result_writer.h"
+
+#include <algorithm>
+
+namespace ba = boost::asio;
+
+namespace network
+{
+
+namespace detail
+{
+
+static const char newline{ '\n' };
+
+result_writer::result_writer( uint64_t max_write_size ) noexcept :
+    m_max_write_size( std::max< uint64_t >( max_write_size, 1 ) ){}
+
+void result_writer::add( std::string result )
+{
+    entry result_entry;
+    result_entry.text = std::move( result );
+    m_results.push_back( std::move( result_entry ) );
+}
+
+void result_writer::add_part( std::string part )
+{
+    if( part.empty() )
+    {
+        return;
+    }
+
+    entry part_entry;
+    part_entry.text = std::move( part );
+    part_entry.newline = false;
+    m_results.push_back( std::move( part_entry ) );
+}
+
+const std::vector< ba::const_buffer >& result_writer::next_buffers()
+{
+    m_buffers.clear();
+    m_pending = 0;
+
+    uint64_t sent{ m_sent };
+    for( const auto& result : m_results )
+    {
+        if( m_pending == m_max_write_size )
+        {
+            break;
+        }
+
+        // the result and its newline
+        const std::string& text = result.text;
+        if( sent < text.size() )
+        {
+            uint64_t size{ std::min< uint64_t >( text.size() - sent, m_max_write_size - m_pending ) };
+            m_buffers.push_back( ba::buffer( text.data() + sent, size ) );
+            m_pending += size;
+            sent += size;
+        }
+
+        if( result.newline && sent == text.size() && m_pending < m_max_write_size )
+        {
+            m_buffers.push_back( ba::buffer( &newline, 1 ) );
+            ++m_pending;
+        }
+
+        sent = 0;
+    }
+
+    return m_buffers;
+}
+
+void result_writer::write_complete() noexcept
+{
+    uint64_t written{ m_pending };
+    m_pending = 0;
+    m_buffers.clear();
+
+    while( written && !m_results.empty() )
+    {
+        uint64_t left{ m_results.front().size() - m_sent };
+        if( written < left )
+        {
+            m_sent += written;
+            return;
+        }
+
+        written -= left;
+        m_sent = 0;
+        m_results.pop_front();
+    }
+}
+
+}// detail
+
+}// network
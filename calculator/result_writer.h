@@ -0,0 +1,64 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+
+namespace network
+{
+
+namespace detail
+{
+
+// Bytes of the results passed to the socket at once
+static constexpr uint64_t default_max_write_size{ 1 << 20 };
+
+// Newline terminated results waiting to be sent. The writer owns the result strings until
+// the socket has taken them, each write gets a scatter/gather sequence over up to max_write_size
+// bytes of them: the small results are coalesced without copying, the big ones go out in chunks
+// and are freed as soon as they are sent. A result may also be added part by part while
+// the rest of it is still being converted
+class result_writer
+{
+public:
+    explicit result_writer( uint64_t max_write_size = default_max_write_size ) noexcept;
+
+    void add( std::string result );
+
+    // Adds the part of a result without the newline, the result ends with the next add()
+    void add_part( std::string part );
+
+    bool empty() const noexcept{ return m_results.empty(); }
+
+    // The buffers of the next write, valid until write_complete()
+    const std::vector< boost::asio::const_buffer >& next_buffers();
+
+    // Drops the data of the last next_buffers()
+    void write_complete() noexcept;
+
+private:
+    uint64_t m_max_write_size{ default_max_write_size };
+    struct entry
+    {
+        std::string text;
+        bool newline{ true };
+
+        uint64_t size() const noexcept{ return text.size() + ( newline? 1 : 0 ); }
+    };
+
+    std::deque< entry > m_results;
+
+    // the bytes of the front entry already sent, its newline included
+    uint64_t m_sent{ 0 };
+    uint64_t m_pending{ 0 };
+    std::vector< boost::asio::const_buffer > m_buffers;
+};
+
+}// detail
+
+}// network
+
+#endif
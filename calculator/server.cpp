@@ -1,5 +1,7 @@
 #include "server.h"
 
+#include <algorithm>
+
 #include "logger.h"
 #include "calc_handle_factory.h"
 
@@ -12,85 +14,368 @@ namespace network
 namespace detail
 {
 
-abstract_calc_session::abstract_calc_session( std::unique_ptr< calc::abstract_calc_handle > handle ) :
-    m_handle( std::move( handle ) )
+// "@" and the name of the number type
+static constexpr uint64_t max_backend_name_length{ 32 };
+
+abstract_calc_session::abstract_calc_session( calc::abstract_calc_handle_factory& factory,
+                                              result_cache* cache,
+                                              uint64_t high_watermark,
+                                              const std::string& spill_directory ) :
+    m_handle_factory( factory ),
+    m_limiter( high_watermark, 0, spill_directory ),
+    m_result_cache( cache ),
+    m_default_backend( factory.default_backend() ){}
+
+abstract_calc_session::~abstract_calc_session()
+{
+    stop();
+}
+
+void abstract_calc_session::start()
+{
+    read_next();
+}
+
+void abstract_calc_session::stop() noexcept
 {
-    if( !m_handle )
+    std::lock_guard< std::mutex > l{ m_pipeline_mutex };
+    for( auto& expr : m_pipeline )
     {
-        throw std::invalid_argument{ "Handle not initialized" };
+        try
+        {
+            if( expr.handle )
+            {
+                expr.handle->abort();
+            }
+        }
+        catch( const std::exception& e )
+        {
+            logger::log( e.what(), logger::to::cerr );
+        }
     }
 }
 
-abstract_calc_session::~abstract_calc_session()
+bool abstract_calc_session::finished() const noexcept
 {
-    try
+    return m_finished;
+}
+
+void abstract_calc_session::on_data( const char* data, uint64_t size, bool eof )
+{
+    assert( data );
+    if( m_write_failed )
+    {
+        return;
+    }
+    const char* data_end{ data + size };
+
+    while( data != data_end )
+    {
+        const char* expr_end{ std::find( data, data_end, '\n' ) };
+        bool expr_complete{ expr_end != data_end };
+        if( expr_complete )
+        {
+            ++expr_end;
+        }
+
+        add_expression_part( data, expr_end - data, expr_complete || ( eof && expr_end == data_end ) );
+        data = expr_end;
+    }
+
+    // Close session if client has closed it, continue reading otherwise.
+    // Once too much data waits for the calculation the client is held back by TCP flow control
+    if( !eof )
     {
-        if( m_handle->running() )
+        if( !m_limiter.pause_if_full( get_resume_handler() ) )
         {
-            m_handle->abort();
-            m_handle->get_result();
+            read_next();
         }
     }
-    catch( const std::exception& e )
+    else
     {
-        logger::log( e.what(), logger::to::cerr );
+        if( m_receiving_expression )
+        {
+            // the client has closed the connection without the trailing newline
+            add_expression_part( "\n", 1, true );
+        }
+
+        m_eof = true;
+        update_finished();
     }
 }
 
-void abstract_calc_session::start()
+void abstract_calc_session::add_expression_part( const char* data, uint64_t size, bool end )
 {
-    m_handle->reset();
-    read_next();
+    if( !m_receiving_expression )
+    {
+        m_receiving_expression = true;
+        m_selecting_backend = true;
+        m_backend.clear();
+        m_hash = content_hash{};
+        m_expression_size = 0;
+
+        // the results of the expressions without the backend prefix depend on the server's default one
+        if( m_result_cache && !m_default_backend.empty() )
+        {
+            m_hash.update( m_default_backend.data(), m_default_backend.size() );
+            m_hash.update( "\n", 1 );
+        }
+    }
+
+    if( m_result_cache )
+    {
+        m_hash.update( data, size );
+        m_expression_size += size;
+    }
+
+    if( m_selecting_backend )
+    {
+        uint64_t prefix_size{ select_backend( data, size, end ) };
+        data += prefix_size;
+        size -= prefix_size;
+
+        if( m_selecting_backend )
+        {
+            return;
+        }
+    }
+
+    expression& expr = m_pipeline.back();
+
+    // the rest of an invalid expression is skipped, the prefix may leave an empty part
+    if( expr.handle && !expr.handle->error_occured() && ( size || end ) )
+    {
+        try
+        {
+            expr.handle->on_data( data, size, end );
+        }
+        catch( const std::exception& e )
+        {
+            // reported as the result of the expression, never thrown out of the io handler
+            expr.handle->abort();
+            expr.result.push_back( e.what() );
+
+            std::lock_guard< std::mutex > l{ m_pipeline_mutex };
+            expr.handle.reset();
+        }
+    }
+
+    if( end )
+    {
+        // the io thread never waits for the calculation
+        m_receiving_expression = false;
+
+        calc::result_handler handler;
+        if( !expr.handle )
+        {
+            // the error is sent once the whole expression is received
+            expr.result_ready = true;
+            flush_results();
+        }
+        else if( !take_cached_result( expr, handler ) )
+        {
+            // the results passed to the cache are whole
+            if( handler )
+            {
+                expr.handle->async_get_result( std::move( handler ) );
+            }
+            else
+            {
+                expr.handle->async_get_result_chunks( get_chunk_handler( expr.id ) );
+            }
+        }
+    }
 }
 
-void abstract_calc_session::stop() noexcept
+uint64_t abstract_calc_session::select_backend( const char* data, uint64_t size, bool end )
 {
-    m_handle->abort();
+    uint64_t pos{ 0 };
+    for( ; pos < size && m_backend.length() <= max_backend_name_length; ++pos )
+    {
+        char c{ data[ pos ] };
+        if( m_backend.empty()? c != '@' : ( c == ' ' || c == '\n' || c == '\r' ) )
+        {
+            break;
+        }
+
+        m_backend += c;
+    }
+
+    if( pos == size && !end && m_backend.length() <= max_backend_name_length )
+    {
+        // the name may go on in the next part
+        return pos;
+    }
+
+    if( !m_backend.empty() && pos < size && data[ pos ] == ' ' )
+    {
+        ++pos;
+    }
+
+    m_selecting_backend = false;
+    start_expression();
+
+    return pos;
 }
 
-bool abstract_calc_session::finished() const noexcept
+void abstract_calc_session::start_expression()
 {
-    return m_finished;
+    expression expr;
+    expr.id = m_next_expression_id++;
+
+    try
+    {
+        expr.handle = m_backend.empty()? m_handle_factory.create() :
+                                         m_handle_factory.create_backend( m_backend.substr( 1 ) );
+        expr.handle->set_ingest_limiter( &m_limiter );
+    }
+    catch( const std::invalid_argument& e )
+    {
+        // reported as the result of the expression, the rest of it is skipped
+        expr.result.push_back( e.what() );
+    }
+
+    std::lock_guard< std::mutex > l{ m_pipeline_mutex };
+    m_pipeline.push_back( std::move( expr ) );
 }
 
-void abstract_calc_session::on_data( const char* data, uint64_t size, bool eof )
+// Returns true if the result comes from the cache, the calculation goes on till it's there. Otherwise
+// the expression may be the first one of its kind, then the handler also passes the result to the cache
+bool abstract_calc_session::take_cached_result( expression& expr, calc::result_handler& handler )
 {
-    assert( data );
+    if( !m_result_cache || m_expression_size < m_result_cache->min_expression_size() ||
+        expr.handle->error_occured() )
+    {
+        return false;
+    }
 
-    bool transmit_complete{ false };
-    bool error_occured{ m_handle->error_occured() };
+    content_key key{ m_hash.digest() };
+    if( m_result_cache->find_or_wait( key, get_cache_handler( expr.id ) ) )
+    {
+        return true;
+    }
 
-    if( size && !error_occured )
+    result_cache* cache{ m_result_cache };
+    calc::abstract_calc_handle* handle{ expr.handle.get() };
+    calc::result_handler session_handler{ get_result_handler( expr.id ) };
+
+    // the handle calls it before its calculation is considered complete, so it's still alive
+    handler = [ cache, key, handle, session_handler ]( std::string result )
     {
-        transmit_complete = ( eof || data[ size - 1 ] == '\n' );
-        m_handle->on_data( data, size, transmit_complete );
+        cache->complete( key, result, !handle->error_occured() );
+        session_handler( std::move( result ) );
+    };
+
+    return false;
+}
+
+void abstract_calc_session::on_result( uint64_t expression_id, std::string& result )
+{
+    assert( !m_pipeline.empty() );
+    assert( expression_id >= m_pipeline.front().id );
+
+    on_result_chunk( expression_id, result, true );
+}
+
+void abstract_calc_session::on_cached_result( uint64_t expression_id, std::string& result, bool found )
+{
+    assert( !m_pipeline.empty() );
+    assert( expression_id >= m_pipeline.front().id );
+
+    expression& expr = m_pipeline[ expression_id - m_pipeline.front().id ];
+    if( found )
+    {
+        // the own calculation is no longer needed
+        expr.handle->abort();
+        on_result( expression_id, result );
+    }
+    else
+    {
+        expr.handle->async_get_result_chunks( get_chunk_handler( expression_id ) );
     }
+}
+
+void abstract_calc_session::on_result_chunk( uint64_t expression_id, std::string& chunk, bool last )
+{
+    assert( !m_pipeline.empty() );
+    assert( expression_id >= m_pipeline.front().id );
 
-    if( transmit_complete || error_occured )
+    expression& expr = m_pipeline[ expression_id - m_pipeline.front().id ];
+    if( !chunk.empty() )
     {
-        write_result();
+        expr.result.push_back( std::move( chunk ) );
     }
 
-    // Close session if client has closed it, continue reading otherwise
-    if( !eof )
+    expr.result_ready = last;
+
+    flush_results();
+}
+
+void abstract_calc_session::on_write_complete()
+{
+    m_writer.write_complete();
+    m_writing = false;
+    flush_results();
+}
+
+void abstract_calc_session::on_write_error()
+{
+    m_write_failed = true;
+    m_writing = false;
+    stop();
+    update_finished();
+}
+
+void abstract_calc_session::flush_results()
+{
+    // the results of the aborted calculations are dropped
+    if( m_write_failed )
     {
-        read_next();
+        return;
     }
-    else
+
+    // results are sent in the order of the expressions, the ready ones are coalesced
+    // into a single write, the chunks of the first unfinished one follow them
+    while( !m_pipeline.empty() )
+    {
+        expression& expr = m_pipeline.front();
+        for( auto& chunk : expr.result )
+        {
+            m_writer.add_part( std::move( chunk ) );
+        }
+
+        expr.result.clear();
+        if( !expr.result_ready )
+        {
+            break;
+        }
+
+        m_writer.add( {} );
+
+        std::lock_guard< std::mutex > l{ m_pipeline_mutex };
+        m_pipeline.pop_front();
+    }
+
+    if( !m_writing && !m_writer.empty() )
     {
-        m_finished = true;
+        m_writing = true;
+        write( m_writer.next_buffers() );
     }
+
+    update_finished();
 }
 
-void abstract_calc_session::write_result()
+void abstract_calc_session::update_finished() noexcept
 {
-    std::string result{ m_handle->get_result() + '\n' };
-    write( result );
+    m_finished = m_write_failed || ( m_eof && m_pipeline.empty() && m_writer.empty() && !m_writing );
 }
 
 tcp_calc_session::tcp_calc_session( ba::io_service& io_service,
-                                    std::unique_ptr< calc::abstract_calc_handle > handler ) :
-    abstract_calc_session( std::move( handler ) ),
+                                    calc::abstract_calc_handle_factory& factory,
+                                    result_cache* cache,
+                                    uint64_t high_watermark,
+                                    const std::string& spill_directory ) :
+    abstract_calc_session( factory, cache, high_watermark, spill_directory ),
     m_socket( io_service ),
     m_strand( io_service ){}
 
@@ -110,19 +395,103 @@ void tcp_calc_session::read_next()
                               m_strand.wrap( handler ) );
 }
 
-void tcp_calc_session::write( const std::string& result )
+void tcp_calc_session::write( const std::vector< ba::const_buffer >& buffers )
+{
+    auto handler = std::bind( &tcp_calc_session::on_written,
+                              shared_from_this(),
+                              std::placeholders::_1 );
+
+    ba::async_write( m_socket, buffers, m_strand.wrap( handler ) );
+}
+
+void tcp_calc_session::on_written( const bs::error_code& err )
+{
+    if( err )
+    {
+        logger::log( err.message(), logger::to::cerr );
+
+        // the pending read completes with an error and isn't repeated
+        bs::error_code ignored;
+        m_socket.close( ignored );
+        on_write_error();
+        return;
+    }
+
+    on_write_complete();
+}
+
+std::function< void( std::string ) > tcp_calc_session::get_result_handler( uint64_t expression_id )
+{
+    std::weak_ptr< tcp_calc_session > weak_session{ shared_from_this() };
+
+    return [ weak_session, expression_id ]( std::string result )
+    {
+        std::shared_ptr< tcp_calc_session > session{ weak_session.lock() };
+        if( session )
+        {
+            session->m_strand.post( std::bind( &tcp_calc_session::on_result,
+                                               session,
+                                               expression_id,
+                                               std::move( result ) ) );
+        }
+    };
+}
+
+calc::chunk_handler tcp_calc_session::get_chunk_handler( uint64_t expression_id )
+{
+    std::weak_ptr< tcp_calc_session > weak_session{ shared_from_this() };
+
+    return [ weak_session, expression_id ]( std::string chunk, bool last )
+    {
+        std::shared_ptr< tcp_calc_session > session{ weak_session.lock() };
+        if( session )
+        {
+            session->m_strand.post( std::bind( &tcp_calc_session::on_result_chunk,
+                                               session,
+                                               expression_id,
+                                               std::move( chunk ),
+                                               last ) );
+        }
+    };
+}
+
+wait_handler tcp_calc_session::get_cache_handler( uint64_t expression_id )
+{
+    std::weak_ptr< tcp_calc_session > weak_session{ shared_from_this() };
+
+    return [ weak_session, expression_id ]( std::string result, bool found )
+    {
+        std::shared_ptr< tcp_calc_session > session{ weak_session.lock() };
+        if( session )
+        {
+            session->m_strand.post( std::bind( &tcp_calc_session::on_cached_result,
+                                               session,
+                                               expression_id,
+                                               std::move( result ),
+                                               found ) );
+        }
+    };
+}
+
+std::function< void() > tcp_calc_session::get_resume_handler()
 {
-    auto handler = std::bind( &tcp_calc_session::start,
-                              shared_from_this() );
+    std::weak_ptr< tcp_calc_session > weak_session{ shared_from_this() };
 
-    m_socket.async_write_some( ba::buffer( result.data(), result.length() ), m_strand.wrap( handler ) );
+    return [ weak_session ]()
+    {
+        std::shared_ptr< tcp_calc_session > session{ weak_session.lock() };
+        if( session )
+        {
+            session->m_strand.post( std::bind( &tcp_calc_session::read_next, session ) );
+        }
+    };
 }
 
 void tcp_calc_session::on_socket_data( const bs::error_code& err, uint64_t bytes_transferred )
 {
     if( !err || err.value() == boost::asio::error::eof )
     {
-        on_data( m_buffer.data(), bytes_transferred, err );
+        on_data( m_buffer.data(), bytes_transferred, static_cast< bool >( err ) );
     }
     else
     {
@@ -132,23 +501,49 @@ void tcp_calc_session::on_socket_data( const bs::error_code& err, uint64_t bytes
 
 }// detail
 
+uint32_t default_io_threads() noexcept
+{
+    return std::max< uint32_t >( boost::thread::hardware_concurrency() / 4, 1 );
+}
+
 abstract_calc_server::abstract_calc_server( calc::abstract_calc_handle_factory& factory,
                                             ba::io_service& io_service,
-                                            uint32_t max_sessions ) noexcept:
-    m_handle_factory( factory ),
+                                            const server_settings& settings ):
     m_io_service( io_service ),
-    m_max_sessions( max_sessions ){}
+    m_handle_factory( factory ),
+    m_high_watermark( settings.high_watermark ),
+    m_spill_directory( settings.spill_directory ),
+    m_max_sessions( settings.max_sessions ),
+    m_io_threads( std::max< uint32_t >( settings.io_threads, 1 ) )
+{
+    if( settings.cache_size || settings.store )
+    {
+        m_result_cache = std::make_shared< result_cache >( settings.cache_size, default_min_cached_size,
+                                                           settings.store );
+    }
+}
+
+void abstract_calc_server::share_result_cache( const abstract_calc_server& other ) noexcept
+{
+    m_result_cache = other.m_result_cache;
+}
 
 void abstract_calc_server::start()
 {
-    m_waiting_session = create_new_session( m_handle_factory.create() );
+    m_waiting_session = create_new_session();
     accept_next_connection();
 
+    if( m_io_threads == 1 )
+    {
+        m_io_service.run();
+        return;
+    }
+
     std::exception_ptr e_ptr;
 
     try
     {
-        for( size_t i{ 0 }; i < m_max_sessions; ++i )
+        for( size_t i{ 0 }; i < m_io_threads; ++i )
         {
             m_pool.create_thread( [ & ](){ m_io_service.run(); } );
         }
@@ -188,7 +583,7 @@ void abstract_calc_server::handle_connection( std::shared_ptr< detail::abstract_
             logger::log( "Connection refused: limit reached", logger::to::cerr );
         }
 
-        m_waiting_session = create_new_session( m_handle_factory.create() );
+        m_waiting_session = create_new_session();
         accept_next_connection();
     }
     else
@@ -199,11 +594,21 @@ void abstract_calc_server::handle_connection( std::shared_ptr< detail::abstract_
 
 tcp_calc_server::tcp_calc_server( calc::abstract_calc_handle_factory& factory,
                                   boost::asio::io_service& io_service,
-                                  uint16_t port,
-                                  uint32_t max_connections ):
-    abstract_calc_server( factory, io_service, max_connections ),
-    m_acceptor( m_io_service,
-                ba::ip::tcp::endpoint{ ba::ip::tcp::v4(), port }, false ){}
+                                  const server_settings& settings ):
+    abstract_calc_server( factory, io_service, settings ),
+    m_acceptor( m_io_service )
+{
+    ba::ip::tcp::endpoint endpoint{ ba::ip::tcp::v4(), settings.port };
+    m_acceptor.open( endpoint.protocol() );
+
+    if( settings.reuse_port )
+    {
+        m_acceptor.set_option( reuse_port_option{ true } );
+    }
+
+    m_acceptor.bind( endpoint );
+    m_acceptor.listen();
+}
 
 void tcp_calc_server::stop()
 {
@@ -229,10 +634,10 @@ bool tcp_calc_server::running() const
     return m_acceptor.is_open();
 }
 
-std::shared_ptr< detail::abstract_calc_session > tcp_calc_server::create_new_session(
-        std::unique_ptr< calc::abstract_calc_handle > handle )
+std::shared_ptr< detail::abstract_calc_session > tcp_calc_server::create_new_session()
 {
-    return std::make_shared< detail::tcp_calc_session >( m_io_service, std::move( handle ) );
+    return std::make_shared< detail::tcp_calc_session >( m_io_service, m_handle_factory,
+                                                         m_result_cache.get(), m_high_watermark, m_spill_directory );
 }
 
 void tcp_calc_server::accept_next_connection()
@@ -249,4 +654,89 @@ void tcp_calc_server::accept_next_connection()
     m_acceptor.async_accept( tcp_session->socket(), handler );
 }
 
+reuse_port_calc_server::reuse_port_calc_server( calc::abstract_calc_handle_factory& factory,
+                                                ba::io_service& io_service,
+                                                const server_settings& settings )
+{
+    uint32_t io_threads{ std::max< uint32_t >( settings.io_threads, 1 ) };
+
+    server_settings thread_settings{ settings };
+    thread_settings.max_sessions = std::max< uint32_t >( ( settings.max_sessions + io_threads - 1 ) / io_threads, 1 );
+    thread_settings.io_threads = 1;
+    thread_settings.reuse_port = true;
+
+    for( uint32_t i{ 0 }; i < io_threads; ++i )
+    {
+        if( i )
+        {
+            m_io_services.emplace_back( new ba::io_service{ 1 } );
+        }
+
+        ba::io_service& thread_service = i? *m_io_services.back() : io_service;
+
+        m_servers.emplace_back( new tcp_calc_server{ factory, thread_service, thread_settings } );
+
+        // the first server creates the cache, the others share it
+        thread_settings.cache_size = 0;
+        thread_settings.store = nullptr;
+        if( i )
+        {
+            m_servers.back()->share_result_cache( *m_servers.front() );
+        }
+    }
+}
+
+void reuse_port_calc_server::start()
+{
+    std::exception_ptr e_ptr;
+
+    try
+    {
+        for( std::size_t i{ 1 }; i < m_servers.size(); ++i )
+        {
+            tcp_calc_server* server{ m_servers[ i ].get() };
+            m_pool.create_thread( [ server ](){ server->start(); } );
+        }
+
+        m_servers.front()->start();
+    }
+    catch( ... )
+    {
+        e_ptr = std::current_exception();
+    }
+
+    if( e_ptr )
+    {
+        stop();
+    }
+
+    m_pool.join_all();
+
+    if( e_ptr )
+    {
+        std::rethrow_exception( e_ptr );
+    }
+}
+
+void reuse_port_calc_server::stop()
+{
+    for( auto& server : m_servers )
+    {
+        server->stop();
+    }
+
+    for( auto& io_service : m_io_services )
+    {
+        io_service->stop();
+    }
+}
+
+bool reuse_port_calc_server::running() const
+{
+    return std::any_of( m_servers.begin(), m_servers.end(), []( const std::unique_ptr< tcp_calc_server >& server )
+    {
+        return server->running();
+    } );
+}
+
 }// network
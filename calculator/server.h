@@ -2,11 +2,18 @@
 #define SERVER_H
 
 #include <list>
+#include <deque>
 #include <mutex>
+#include <vector>
+#include <functional>
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 
+#include "result_cache.h"
+#include "ingest_limiter.h"
+#include "result_writer.h"
+
 namespace calc
 {
 
@@ -21,10 +28,24 @@ namespace network
 namespace detail
 {
 
+// Every newline terminated expression received by the session gets its own handle,
+// so the expressions pipelined by the client are calculated concurrently.
+// The results are sent back in the order of the expressions, the leading chunks of a huge one
+// while the rest of it is still being converted.
+// An expression starting with "@<backend> " is calculated with the named number type.
+// The expressions already calculated or being calculated by any session are taken from the cache,
+// the waiting ones go on calculating in case the first one fails.
+// The reading pauses while the received data waiting for the calculation exceeds the high watermark,
+// unless the data over it is spilled to the temporary files in the spill directory.
+// on_data(), on_result(), on_result_chunk(), on_cached_result() and on_write_complete() should be called
+// from the same execution context(e.g. strand)
 class abstract_calc_session
 {
 public:
-    abstract_calc_session( std::unique_ptr< calc::abstract_calc_handle > handle );
+    abstract_calc_session( calc::abstract_calc_handle_factory& factory,
+                           result_cache* cache = nullptr,
+                           uint64_t high_watermark = calc::default_high_watermark,
+                           const std::string& spill_directory = {} );
     virtual ~abstract_calc_session();
 
     virtual void start();
@@ -33,15 +54,84 @@ public:
 
 protected:
     void on_data( const char* data, uint64_t size, bool eof );
+    void on_result( uint64_t expression_id, std::string& result );
+    void on_result_chunk( uint64_t expression_id, std::string& chunk, bool last );
+    void on_cached_result( uint64_t expression_id, std::string& result, bool found );
+    void on_write_complete();
+
+    // The connection is lost: the calculations are aborted and nothing is sent or received anymore
+    void on_write_error();
+
     virtual void read_next() = 0;
-    virtual void write( const std::string& result ) = 0;
+
+    // Should call on_write_complete() once all the data is sent, the buffers stay valid till then
+    virtual void write( const std::vector< boost::asio::const_buffer >& buffers ) = 0;
+
+    // Returns the handler that passes the result from the compute thread
+    // back to the session's execution context(on_result()). Shouldn't call
+    // on_result() directly, the handle may not be destroyed from within the handler
+    virtual std::function< void( std::string ) > get_result_handler( uint64_t expression_id ) = 0;
+
+    // The same for the chunks of the result, passes them to on_result_chunk()
+    virtual calc::chunk_handler get_chunk_handler( uint64_t expression_id ) = 0;
+
+    // The same for the result of the expression waiting in the cache, passes it to on_cached_result()
+    virtual wait_handler get_cache_handler( uint64_t expression_id ) = 0;
+
+    // Returns the handler that calls read_next() in the session's execution context, it's called
+    // from the compute thread once the paused session's data is consumed down to the low watermark
+    virtual std::function< void() > get_resume_handler() = 0;
 
 private:
-    void write_result();
+    struct expression
+    {
+        uint64_t id{ 0 };
+        std::unique_ptr< calc::abstract_calc_handle > handle;
+        bool result_ready{ false };
+
+        // the chunks received before the expression's turn to be sent
+        std::vector< std::string > result;
+    };
+
+    void add_expression_part( const char* data, uint64_t size, bool end );
+    uint64_t select_backend( const char* data, uint64_t size, bool end );
+    void start_expression();
+    bool take_cached_result( expression& expr, calc::result_handler& handler );
+    void flush_results();
+    void update_finished() noexcept;
 
 private:
+    calc::abstract_calc_handle_factory& m_handle_factory;
+
+    // outlives the handles, their calculations release the data into it
+    calc::ingest_limiter m_limiter;
+
+    // Expressions waiting for their results to be sent, the last one
+    // may still be receiving the data. The mutex guards the changes of the deque
+    // and the handles against stop() called by the server's thread
+    std::deque< expression > m_pipeline;
+    std::mutex m_pipeline_mutex;
+    bool m_receiving_expression{ false };
+    uint64_t m_next_expression_id{ 0 };
+
+    // The backend prefix of the expression being received, may be split between the reads
+    bool m_selecting_backend{ false };
+    std::string m_backend;
+
+    // The whole text of the expression being received is hashed, the backend prefix and the name
+    // of the default backend included
+    result_cache* m_result_cache{ nullptr };
+    std::string m_default_backend;
+    content_hash m_hash;
+    uint64_t m_expression_size{ 0 };
+
+    // Results of the finished expressions wait here while the previous write is in progress
+    result_writer m_writer;
+    bool m_writing{ false };
+    bool m_write_failed{ false };
+    bool m_eof{ false };
+
     std::atomic_bool m_finished{ false };
-    std::unique_ptr< calc::abstract_calc_handle > m_handle;
 };
 
 class tcp_calc_session : public std::enable_shared_from_this< tcp_calc_session >,
@@ -49,18 +139,27 @@ class tcp_calc_session : public std::enable_shared_from_this< tcp_calc_session >
 {
 public:
     tcp_calc_session( boost::asio::io_service& io_service,
-                      std::unique_ptr< calc::abstract_calc_handle > handler );
+                      calc::abstract_calc_handle_factory& factory,
+                      result_cache* cache = nullptr,
+                      uint64_t high_watermark = calc::default_high_watermark,
+                      const std::string& spill_directory = {} );
 
     boost::asio::ip::tcp::socket& socket() noexcept;
 
 protected:
     void read_next() override;
-    void write( const std::string& result ) override;
+    void write( const std::vector< boost::asio::const_buffer >& buffers ) override;
+    std::function< void( std::string ) > get_result_handler( uint64_t expression_id ) override;
+    calc::chunk_handler get_chunk_handler( uint64_t expression_id ) override;
+    wait_handler get_cache_handler( uint64_t expression_id ) override;
+    std::function< void() > get_resume_handler() override;
 
 private:
     void on_socket_data( const boost::system::error_code& err,
                          uint64_t bytes_transferred );
 
+    void on_written( const boost::system::error_code& err );
+
 private:
     std::array< char, 8192 > m_buffer;
     boost::asio::ip::tcp::socket m_socket;
@@ -69,22 +168,82 @@ private:
 
 }// detail
 
+// The io threads only move the data and calculate the small inline expressions,
+// so a quarter of the cores is enough for them
+uint32_t default_io_threads() noexcept;
+
+struct server_settings
+{
+    uint16_t port{ 0 };
+    uint32_t max_sessions{ boost::thread::hardware_concurrency() };
+    // The byte budget of the results shared by the sessions, 0 turns the cache off
+    uint64_t cache_size{ 0 };
+    // Keeps the results between the runs, it should outlive the server
+    disk_result_store* store{ nullptr };
+    // Limits the received data of a session waiting for the calculation, 0 = unlimited
+    uint64_t high_watermark{ calc::default_high_watermark };
+    // The data over the high watermark is written to the temporary files there instead
+    std::string spill_directory;
+    // Run the io_service, the calculations are done by the executor's compute threads
+    uint32_t io_threads{ default_io_threads() };
+    // Several acceptors may listen to the port
+    bool reuse_port{ false };
+};
+
+// SO_REUSEPORT as a settable socket option of the acceptor
+class reuse_port_option
+{
+public:
+    explicit reuse_port_option( bool value ) noexcept : m_value( value? 1 : 0 ){}
+
+    template< typename protocol >
+    int level( const protocol& ) const noexcept
+    {
+        return SOL_SOCKET;
+    }
+
+    template< typename protocol >
+    int name( const protocol& ) const noexcept
+    {
+        return SO_REUSEPORT;
+    }
+
+    template< typename protocol >
+    const int* data( const protocol& ) const noexcept
+    {
+        return &m_value;
+    }
+
+    template< typename protocol >
+    std::size_t size( const protocol& ) const noexcept
+    {
+        return sizeof( m_value );
+    }
+
+private:
+    int m_value;
+};
+
 class abstract_calc_server
 {
 public:
+    // The port and reuse_port are used by the listening servers
     abstract_calc_server( calc::abstract_calc_handle_factory& factory,
                           boost::asio::io_service& io_service,
-                          uint32_t max_sessions ) noexcept;
+                          const server_settings& settings );
 
     virtual ~abstract_calc_server() = default;
 
+    // Runs the io threads till the io_service is stopped, a single one is the calling thread
     void start();
     virtual void stop() = 0;
     virtual bool running() const = 0;
 
+    // The sessions of both servers use the cache of the other one, should be called before start()
+    void share_result_cache( const abstract_calc_server& other ) noexcept;
+
 protected:
-    virtual std::shared_ptr< detail::abstract_calc_session > create_new_session(
-                    std::unique_ptr< calc::abstract_calc_handle > handle )  = 0;
+    virtual std::shared_ptr< detail::abstract_calc_session > create_new_session() = 0;
 
     virtual void accept_next_connection() = 0;
     void handle_connection( std::shared_ptr< detail::abstract_calc_session >& session,
@@ -94,8 +253,12 @@ protected:
     boost::thread_group m_pool;
     boost::asio::io_service& m_io_service;
     calc::abstract_calc_handle_factory& m_handle_factory;
+    std::shared_ptr< result_cache > m_result_cache;
+    uint64_t m_high_watermark{ calc::default_high_watermark };
+    std::string m_spill_directory;
 
     uint32_t m_max_sessions{ 0 };
+    uint32_t m_io_threads{ 1 };
     std::shared_ptr< detail::abstract_calc_session > m_waiting_session;
     std::list< std::shared_ptr< detail::abstract_calc_session > > m_running_sessions;
 };
@@ -105,15 +268,13 @@ class tcp_calc_server : public abstract_calc_server
 public:
     tcp_calc_server( calc::abstract_calc_handle_factory& factory,
                      boost::asio::io_service& io_service,
-                     uint16_t port,
-                     uint32_t max_sessions = boost::thread::hardware_concurrency() );
+                     const server_settings& settings );
 
     void stop() override;
     bool running() const override;
 
 protected:
-    std::shared_ptr< detail::abstract_calc_session > create_new_session(
-                std::unique_ptr< calc::abstract_calc_handle > handle ) override;
+    std::shared_ptr< detail::abstract_calc_session > create_new_session() override;
 
     void accept_next_connection() override;
 
@@ -122,6 +283,27 @@ private:
     mutable std::mutex m_mutex;
 };
 
+// One io_service with its own SO_REUSEPORT acceptor and sessions per io thread, the kernel balances
+// the connections between the acceptors, so the threads share only the result cache and the compute pool.
+// Each thread accepts up to its share of max_sessions
+class reuse_port_calc_server
+{
+public:
+    // io_service is run by the first thread, the others get their own ones
+    reuse_port_calc_server( calc::abstract_calc_handle_factory& factory,
+                            boost::asio::io_service& io_service,
+                            const server_settings& settings );
+
+    void start();
+    void stop();
+    bool running() const;
+
+private:
+    std::vector< std::unique_ptr< boost::asio::io_service > > m_io_services;
+    std::vector< std::unique_ptr< tcp_calc_server > > m_servers;
+    boost::thread_group m_pool;
+};
+
 }// network
 
 #endif
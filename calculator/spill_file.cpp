@@ -0,0 +1,76 @@
+#include "spill_file.h"
+
+#include <ios>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+#include <stdlib.h>
+
+namespace calc
+{
+
+spill_file::spill_file( const std::string& directory )
+{
+    std::string pattern{ directory + "/calc_spill_XXXXXX" };
+    std::vector< char > path( pattern.begin(), pattern.end() );
+    path.push_back( '\0' );
+
+    m_fd = ::mkstemp( path.data() );
+    if( m_fd < 0 )
+    {
+        throw std::ios_base::failure{ "Failed to create spill file in: " + directory };
+    }
+
+    ::unlink( path.data() );
+}
+
+spill_file::~spill_file()
+{
+    ::close( m_fd );
+}
+
+void spill_file::append( const char* data, uint64_t size )
+{
+    // written after the end of the data, so a failed write leaves nothing behind
+    uint64_t offset{ m_written };
+    while( size )
+    {
+        ssize_t written{ ::pwrite( m_fd, data, size, static_cast< off_t >( offset ) ) };
+        if( written < 0 )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+
+            throw std::ios_base::failure{ "Failed to write spill file" };
+        }
+
+        data += written;
+        size -= static_cast< uint64_t >( written );
+        offset += static_cast< uint64_t >( written );
+    }
+
+    m_written = offset;
+}
+
+std::unique_ptr< mapped_file > spill_file::map_unread( uint64_t max_size ) const
+{
+    return std::unique_ptr< mapped_file >{ new mapped_file{ m_fd, m_read, std::min( unread(), max_size ) } };
+}
+
+void spill_file::mark_read( uint64_t size ) noexcept
+{
+    m_read += std::min( size, unread() );
+
+    if( m_read == m_written )
+    {
+        ::ftruncate( m_fd, 0 );
+        m_read = 0;
+        m_written = 0;
+    }
+}
+
+} // calc
@@ -0,0 +1,44 @@
+#ifndef SPILL_FILE_H
+#define SPILL_FILE_H
+
+#include <memory>
+#include <string>
+
+#include "mapped_file.h"
+
+namespace calc
+{
+
+// Size of the spilled data mapped at once for the calculation
+static constexpr uint64_t spill_window_size{ 4 << 20 };
+
+// Parts of an expression received faster than they are calculated. They are appended
+// to an unlinked temporary file, so the disk space is freed even if the server is killed,
+// and are read back through mmap in the order they were written
+class spill_file
+{
+public:
+    explicit spill_file( const std::string& directory );
+    ~spill_file();
+
+    spill_file( const spill_file& ) = delete;
+    spill_file& operator=( const spill_file& ) = delete;
+
+    void append( const char* data, uint64_t size );
+    uint64_t unread() const noexcept{ return m_written - m_read; }
+
+    // Maps up to max_size of the unread data, should be destroyed before mark_read()
+    std::unique_ptr< mapped_file > map_unread( uint64_t max_size = spill_window_size ) const;
+
+    // The file is emptied once all the data is read
+    void mark_read( uint64_t size ) noexcept;
+
+private:
+    int m_fd{ -1 };
+    uint64_t m_written{ 0 };
+    uint64_t m_read{ 0 };
+};
+
+} // calc
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef SUBEXPRESSION_MEMO_H
+#define SUBEXPRESSION_MEMO_H
+
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+namespace calc
+{
+
+// Text of the memoized subexpressions kept by a calculation at most
+static constexpr std::size_t default_memo_capacity{ 16 << 20 };
+
+// Shorter groups are calculated as usual
+static constexpr std::size_t min_memo_text_size{ 32 };
+
+// Polynomial hash of the text, updated character by character as the text streams by
+inline uint64_t memo_hash_step( uint64_t hash, char c ) noexcept
+{
+    return hash * 0x100000001b3ull + static_cast< unsigned char >( c );
+}
+
+// Values of the parenthesized subexpressions by their text. The expressions built by repeating
+// a block contain the same groups thousands of times, each of them is calculated once.
+// The hash only selects the candidates, the text is compared to make sure it's the same group
+template< typename type >
+class subexpression_memo
+{
+public:
+    explicit subexpression_memo( std::size_t max_text_size, std::size_t capacity = default_memo_capacity ) :
+        m_max_text_size( max_text_size ),
+        m_capacity( capacity ){}
+
+    // Longer groups aren't memoized: their text would be buffered for too long
+    std::size_t max_text_size() const noexcept{ return m_max_text_size; }
+
+    const type* find( const std::string& text, uint64_t hash ) const
+    {
+        auto range = m_values.equal_range( hash );
+        for( auto it = range.first; it != range.second; ++it )
+        {
+            if( it->second.first == text )
+            {
+                return &it->second.second;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Nothing is added after the capacity is reached, the values found so far are still used
+    void add( const std::string& text, uint64_t hash, const type& value )
+    {
+        if( m_size + text.length() > m_capacity )
+        {
+            return;
+        }
+
+        m_size += text.length();
+        m_values.emplace( hash, std::make_pair( text, value ) );
+    }
+
+    void clear()
+    {
+        m_values.clear();
+        m_size = 0;
+    }
+
+private:
+    std::size_t m_max_text_size{ 0 };
+    std::size_t m_capacity{ default_memo_capacity };
+    std::size_t m_size{ 0 };
+
+    std::unordered_multimap< uint64_t, std::pair< std::string, type > > m_values;
+};
+
+} // calc
+
+#endif
@@ -1,15 +1,42 @@
 #ifndef MOCKS_H
 #define MOCKS_H
 
+#include <tuple>
+
 #include "calc_handle_factory.h"
 #include "server.h"
 
+// Shared by all the handles created by the factory,
+// since sessions destroy handles once the result is sent
+struct mock_handle_stats
+{
+    uint64_t on_data_calls{ 0 };
+    uint64_t results_taken{ 0 };
+    bool error_occured{ false };
+    bool throw_on_data{ false };
+
+    // the received data is counted as waiting until the test releases it
+    calc::ingest_limiter* limiter{ nullptr };
+};
+
 class mock_calc_handle : public calc::abstract_calc_handle
 {
 public:
-    void on_data( const char* data, uint64_t size, bool end = false ) override
+    explicit mock_calc_handle( mock_handle_stats& stats ) : _stats( stats ){}
+
+    void on_data( const char*, uint64_t size, bool end = false ) override
     {
-        ++_on_data_calls;
+        ++_stats.on_data_calls;
+        if( _stats.throw_on_data )
+        {
+            throw std::runtime_error{ "Handle failure" };
+        }
+
+        if( _stats.limiter )
+        {
+            _stats.limiter->add( size );
+        }
+
         if( end )
         {
             _finished = true;
@@ -18,21 +45,29 @@ public:
 
     bool running() const noexcept override{ return _running; }
     bool finished() const noexcept override{ return _finished; }
-    bool error_occured() const noexcept override{ return _error_occured; }
+    bool error_occured() const noexcept override{ return _stats.error_occured; }
     void abort() override{ _running = false; }
     void reset() override{}
 
     std::string get_result() override
     {
-        _result_taken = true;
+        ++_stats.results_taken;
         return "test";
     }
 
+    void async_get_result( calc::result_handler handler ) override
+    {
+        handler( get_result() );
+    }
+
+    void set_ingest_limiter( calc::ingest_limiter* limiter ) override
+    {
+        _stats.limiter = limiter;
+    }
+
     bool _running{ false };
     bool _finished{ false };
-    bool _error_occured{ false };
-    bool _result_taken{ false };
-    uint64_t _on_data_calls{ 0 };
+    mock_handle_stats& _stats;
 };
 
 class mock_session : public network::detail::abstract_calc_session
@@ -50,14 +85,105 @@ protected:
         ++reads_occured;
     }
 
-    void write( const std::string& ) override
+    void write( const std::vector< boost::asio::const_buffer >& buffers ) override
     {
         write_occured = true;
+        ++writes_occured;
+
+        for( const auto& buffer : buffers )
+        {
+            written.append( boost::asio::buffer_cast< const char* >( buffer ), boost::asio::buffer_size( buffer ) );
+        }
+
+        if( complete_writes )
+        {
+            on_write_complete();
+        }
+    }
+
+    std::function< void( std::string ) > get_result_handler( uint64_t expression_id ) override
+    {
+        return [ this, expression_id ]( std::string result )
+        {
+            results.emplace_back( expression_id, std::move( result ), true );
+        };
+    }
+
+    calc::chunk_handler get_chunk_handler( uint64_t expression_id ) override
+    {
+        return [ this, expression_id ]( std::string chunk, bool last )
+        {
+            results.emplace_back( expression_id, std::move( chunk ), last );
+        };
+    }
+
+    network::wait_handler get_cache_handler( uint64_t expression_id ) override
+    {
+        return [ this, expression_id ]( std::string result, bool found )
+        {
+            cached_results.emplace_back( expression_id, std::move( result ), found );
+        };
+    }
+
+    std::function< void() > get_resume_handler() override
+    {
+        return [ this ]()
+        {
+            ++resumes_occured;
+            read_next();
+        };
     }
 
 public:
+    // results are held until deliver_result() is called to emulate the compute threads
+    void deliver_result( std::size_t index )
+    {
+        on_result_chunk( std::get< 0 >( results[ index ] ), std::get< 1 >( results[ index ] ), std::get< 2 >( results[ index ] ) );
+    }
+
+    // the results from the cache may release the own calculations, which add more results
+    void deliver_all_results()
+    {
+        while( !results.empty() || !cached_results.empty() )
+        {
+            auto delivered = std::move( results );
+            auto cached = std::move( cached_results );
+            results.clear();
+            cached_results.clear();
+
+            for( auto& result : delivered )
+            {
+                on_result_chunk( std::get< 0 >( result ), std::get< 1 >( result ), std::get< 2 >( result ) );
+            }
+
+            for( auto& result : cached )
+            {
+                on_cached_result( std::get< 0 >( result ), std::get< 1 >( result ), std::get< 2 >( result ) );
+            }
+        }
+    }
+
+    void finish_write()
+    {
+        on_write_complete();
+    }
+
+    void fail_write()
+    {
+        on_write_error();
+    }
+
     uint64_t reads_occured{ 0 };
+    uint64_t resumes_occured{ 0 };
     bool write_occured{ false };
+    uint64_t writes_occured{ 0 };
+    bool complete_writes{ true };
+    std::string written;
+    // the expression id, the result or its chunk and whether it's the last one
+    std::vector< std::tuple< uint64_t, std::string, bool > > results;
+
+    // the expression id, the result and whether it was found
+    std::vector< std::tuple< uint64_t, std::string, bool > > cached_results;
 };
 
 class test_server : public network::abstract_calc_server
@@ -81,10 +207,9 @@ public:
         return m_running_sessions;
     }
 
-    std::shared_ptr< network::detail::abstract_calc_session > create_new_session(
-            std::unique_ptr< calc::abstract_calc_handle > handle ) override
+    std::shared_ptr< network::detail::abstract_calc_session > create_new_session() override
     {
-        return std::make_shared< mock_session >( std::move( handle ) );
+        return std::make_shared< mock_session >( m_handle_factory );
     }
 
     void handle_connection_accessor( std::shared_ptr< network::detail::abstract_calc_session >& session,
@@ -106,8 +231,10 @@ class mock_handle_factory : public calc::abstract_calc_handle_factory
 public:
     std::unique_ptr< calc::abstract_calc_handle > create() const override
     {
-        return std::make_unique< mock_calc_handle >();
+        return std::make_unique< mock_calc_handle >( _stats );
     }
+
+    mutable mock_handle_stats _stats;
 };
 
 #endif
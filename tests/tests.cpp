@@ -1,11 +1,22 @@
 #define BOOST_TEST_MODULE "Tests"
 
 #include <map>
+#include <thread>
+#include <random>
 #include <boost/test/included/unit_test.hpp>
 
 #include "generator.h"
 
 #include "mocks.h"
+#include "parallel_calculator.h"
+#include "hybrid_integer.h"
+#include "checked_integer.h"
+#include "backend_registry.h"
+#include "gmp_integer.h"
+#include "decimal_integer.h"
+#include "disk_result_store.h"
+#include "batch_calculator.h"
+#include "big_integer_traits.h"
 
 BOOST_AUTO_TEST_CASE( calc_full_expr )
 {
@@ -25,8 +36,8 @@ BOOST_AUTO_TEST_CASE( calc_full_expr )
         std::future< int64_t > f;
         int64_t result;
 
-        BOOST_REQUIRE_NO_THROW( f = std::move( c.start( expr_res.first ) ) )
-        BOOST_REQUIRE_NO_THROW( result = f.get() )
+        BOOST_REQUIRE_NO_THROW( f = std::move( c.start( expr_res.first ) ) );
+        BOOST_REQUIRE_NO_THROW( result = f.get() );
         BOOST_REQUIRE( result = expr_res.second );
     }
 }
@@ -36,8 +47,8 @@ void check_expr_throw( const std::string& expr )
     calc::async_calculator< int64_t > c;
     std::future< int64_t > f;
 
-    BOOST_REQUIRE_NO_THROW( f = c.start( expr ) )
-    BOOST_REQUIRE_THROW( f.get(), std::logic_error )
+    BOOST_REQUIRE_NO_THROW( f = c.start( expr ) );
+    BOOST_REQUIRE_THROW( f.get(), std::logic_error );
     BOOST_REQUIRE( c.error_occured() );
     BOOST_REQUIRE( !c.running() );
     BOOST_REQUIRE( c.finished() );
@@ -69,16 +80,16 @@ BOOST_AUTO_TEST_CASE( calc_invalid_expr )
     calc::async_calculator< int64_t > c;
     std::future< int64_t > f;
 
-    BOOST_REQUIRE_THROW( c.start( "" ), std::invalid_argument )
-    BOOST_REQUIRE_THROW( c.add_expr_part( "" ), std::invalid_argument )
-    BOOST_REQUIRE_THROW( c.add_expr_part( "1+2\n" ), std::logic_error )
+    BOOST_REQUIRE_THROW( c.start( "" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( c.add_expr_part( "" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( c.add_expr_part( "1+2\n" ), std::logic_error );
 
     // add_expr_part
 
-    BOOST_REQUIRE_NO_THROW( f = c.start( "1 + 2 * (" ) )
-    BOOST_REQUIRE_THROW( c.add_expr_part( "" );, std::invalid_argument )
-    BOOST_REQUIRE_NO_THROW( c.add_expr_part( "\n" ) )
-    BOOST_REQUIRE_THROW( f.get(), std::logic_error )
+    BOOST_REQUIRE_NO_THROW( f = c.start( "1 + 2 * (" ) );
+    BOOST_REQUIRE_THROW( c.add_expr_part( "" );, std::invalid_argument );
+    BOOST_REQUIRE_NO_THROW( c.add_expr_part( "\n" ) );
+    BOOST_REQUIRE_THROW( f.get(), std::logic_error );
 }
 
 BOOST_AUTO_TEST_CASE( calc_sequential_expr_supply )
@@ -93,31 +104,541 @@ BOOST_AUTO_TEST_CASE( calc_sequential_expr_supply )
     std::future< int64_t > f;
     int64_t result;
 
-    BOOST_REQUIRE_NO_THROW( f = c.start( expr_parts[ 0 ] ) )
+    BOOST_REQUIRE_NO_THROW( f = c.start( expr_parts[ 0 ] ) );
 
     for( size_t i{ 1 }; i < expr_parts.size(); ++i )
     {
-        BOOST_REQUIRE_NO_THROW( c.add_expr_part( expr_parts[ i ] ) )
+        BOOST_REQUIRE_NO_THROW( c.add_expr_part( expr_parts[ i ] ) );
     }
 
-    BOOST_REQUIRE_NO_THROW( result = f.get() )
+    BOOST_REQUIRE_NO_THROW( result = f.get() );
     BOOST_REQUIRE( result = 3 );
     BOOST_REQUIRE( !c.error_occured() );
     BOOST_REQUIRE( !c.running() );
     BOOST_REQUIRE( c.finished() );
 }
 
+BOOST_AUTO_TEST_CASE( calc_parked_calculation_frees_worker )
+{
+    calc::executor e{ 1 };
+    calc::async_calculator< int64_t > waiting{ e };
+    calc::async_calculator< int64_t > complete{ e };
+    std::future< int64_t > waiting_f;
+    std::future< int64_t > complete_f;
+
+    // the only worker must not be held by the calculation waiting for data
+    BOOST_REQUIRE_NO_THROW( waiting_f = waiting.start( "1 + 2 *" ) );
+    BOOST_REQUIRE_NO_THROW( complete_f = complete.start( "2 * 3\n" ) );
+    BOOST_REQUIRE( complete_f.wait_for( std::chrono::seconds{ 5 } ) == std::future_status::ready );
+    BOOST_REQUIRE( complete_f.get() == 6 );
+    BOOST_REQUIRE( waiting.running() );
+
+    BOOST_REQUIRE_NO_THROW( waiting.add_expr_part( " 3 - 1\n" ) );
+    BOOST_REQUIRE( waiting_f.get() == 6 );
+}
+
+BOOST_AUTO_TEST_CASE( evaluator_resumes_mid_token )
+{
+    std::string expr{ "(-12 + 345) * ( 67 - 8 ) / 9\r\n" };
+
+    calc::expression_evaluator< int64_t > e;
+    std::size_t consumed{ 0 };
+
+    // every character comes in its own chunk
+    for( size_t i{ 0 }; i < expr.length() && !e.finished(); ++i )
+    {
+        BOOST_REQUIRE_NO_THROW( consumed += e.consume( expr.data() + i, 1 ) );
+    }
+
+    BOOST_REQUIRE( e.finished() );
+    BOOST_REQUIRE( consumed == expr.length() - 1 );
+    BOOST_REQUIRE( e.result() == 2183 );
+
+    e.reset();
+    std::string invalid{ "12 34\n" };
+    BOOST_REQUIRE_THROW( e.consume( invalid.data(), invalid.length() ), std::logic_error );
+}
+
+BOOST_AUTO_TEST_CASE( evaluator_operator_runs )
+{
+    std::map< std::string, int64_t > expr_res_map
+    {
+        { "1 - 2 + 3 - 4 + 5 - 6 + 7\n", 4 },
+        { "10 - 3 - 2 - 1\n", 4 },
+        { "2 * 3 * 4 * 5 * 6 * 7 * 8\n", 40320 },
+        { "100 / 5 * 2 / 4 * 3\n", 30 },
+        { "1 - 2 * 3 * 4 + 5 - 6 / 2 + 1\n", -20 },
+        { "-5 - 3 + ( 2 - 7 - 1 ) * 2 * 3 - 4\n", -48 },
+        { "7 - ( 1 - 2 - 3 ) * 2 - 1 - 1\n", 13 }
+    };
+
+    for( const auto& expr_res : expr_res_map )
+    {
+        calc::expression_evaluator< int64_t > e;
+        BOOST_REQUIRE_NO_THROW( e.consume( expr_res.first.data(), expr_res.first.length() ) );
+        BOOST_REQUIRE( e.result() == expr_res.second );
+    }
+
+    // long run keeps the stack short and the signs right
+    std::string run{ "1" };
+    for( size_t i{ 0 }; i < 1000; ++i )
+    {
+        run += i % 3? " + 2" : " - 1";
+    }
+
+    run += '\n';
+
+    calc::expression_evaluator< int64_t > e;
+    BOOST_REQUIRE_NO_THROW( e.consume( run.data(), run.length() ) );
+    BOOST_REQUIRE( e.result() == 1 + 666 * 2 - 334 );
+}
+
+BOOST_AUTO_TEST_CASE( evaluator_zero_products )
+{
+    // the factors following a zero are only validated, so neither the division nor the huge number fails
+    std::map< std::string, int64_t > expr_res_map
+    {
+        { "0 * ( 1 / 0 ) + 4\n", 4 },
+        { "2 - 3 * 0 * 123456789012345678901234567890 + 1\n", 3 },
+        { "( 5 - 5 ) * ( 7 * ( 2 / 0 ) - 1 ) * 3 - 2\n", -2 },
+        { "7 * ( 0 * ( 1 / 0 ) + 2 )\n", 14 },
+
+        // the zero isn't the last operand of the partially reduced run
+        { "0 * 2 * ( 1 / 0 )\n", 0 },
+        { "0 * 2 * 3 * ( 1 / 0 )\n", 0 },
+        { "0 * 2 * 3 * 123456789012345678901234567890 + 1\n", 1 },
+        { "5 * 0 * 2 * 3 * 4 * ( 1 / 0 ) + 6\n", 6 },
+        { "2 * 3 * ( 4 - 4 ) * 5 * ( 1 / 0 )\n", 0 }
+    };
+
+    calc::executor exec{ 2 };
+    for( const auto& expr_res : expr_res_map )
+    {
+        calc::expression_evaluator< int64_t > e;
+        BOOST_REQUIRE_NO_THROW( e.consume( expr_res.first.data(), expr_res.first.length() ) );
+        BOOST_REQUIRE( e.result() == expr_res.second );
+
+        calc::parallel_calculator< int64_t > c{ exec, 2 };
+        BOOST_REQUIRE( c.calculate( expr_res.first.data(), expr_res.first.length() ) == expr_res.second );
+    }
+
+    // a divisor is calculated, syntax is checked in the skipped parts too
+    for( const std::string expr : { "0 * 5 / ( 3 - 3 )\n", "0 * ( 1 + ) + 2\n", "0 * ( 1 + 2\n" } )
+    {
+        calc::expression_evaluator< int64_t > e;
+        BOOST_REQUIRE_THROW( e.consume( expr.data(), expr.length() ), std::logic_error );
+
+        calc::parallel_calculator< int64_t > c{ exec, 2 };
+        BOOST_REQUIRE_THROW( c.calculate( expr.data(), expr.length() ), std::logic_error );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( calc_subexpression_memo )
+{
+    std::string block{ "( 17 * ( 3 - 250 / ( 4 + 1 ) ) + ( 123456 - 654321 ) * 2 )" };
+    std::string expr{ block };
+    for( size_t i{ 0 }; i < 100; ++i )
+    {
+        expr += i % 2? " + " : " - ";
+        expr += i % 3? block : "( 1 + 2 * ( 3 - 4 ) * 5 * ( 6 - 7 * 8 ) )";
+    }
+
+    expr += '\n';
+
+    calc::expression_evaluator< int64_t > e;
+    e.consume( expr.data(), expr.length() );
+    int64_t expected{ e.result() };
+
+    // the groups split between the parts, too long for the memo or failing are calculated as usual
+    for( size_t memo_limit : { 16, 64, 4096 } )
+    {
+        calc::async_calculator< int64_t > c{ calc::executor::instance(), memo_limit };
+
+        std::future< int64_t > f{ c.start( expr.substr( 0, 7 ) ) };
+        for( size_t pos{ 7 }; pos < expr.length(); pos += 7 )
+        {
+            c.add_expr_part( expr.substr( pos, 7 ) );
+        }
+
+        BOOST_REQUIRE( f.get() == expected );
+
+        std::string invalid{ block + " + " + block + " * ( 2 / ( 3 - 3 ) + 1 * 2 * 3 * 4 * 5 * 6 )\n" };
+        f = c.start( invalid );
+        BOOST_REQUIRE_THROW( f.get(), std::logic_error );
+
+        std::string unclosed{ block + " + ( " + block + "\n" };
+        f = c.start( unclosed );
+        BOOST_REQUIRE_THROW( f.get(), std::logic_error );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( executor_nested_run_parallel )
+{
+    // every worker waits for the bodies of its own nested call
+    calc::executor exec{ 2 };
+    std::atomic< int > done{ 0 };
+
+    exec.run_parallel( 4, [ & ]( std::size_t )
+    {
+        exec.run_parallel( 3, [ & ]( std::size_t ){ ++done; } );
+    } );
+
+    BOOST_REQUIRE_EQUAL( done.load(), 12 );
+
+    // the exception of the lowest index is rethrown
+    BOOST_REQUIRE_THROW( exec.run_parallel( 3, []( std::size_t i )
+    {
+        if( i )
+        {
+            throw std::runtime_error{ std::to_string( i ) };
+        }
+    } ), std::runtime_error );
+}
+
+BOOST_AUTO_TEST_CASE( parallel_calculation )
+{
+    calc::executor exec{ 4 };
+
+    std::vector< std::string > exprs
+    {
+        "1 - 2 + 3 - 4 + 5 - 6 + 7",
+        "100 / 5 * 2 / 4 * 3 - 17 * 3 + ( 8 - 2 * 3 ) * 11",
+        "-5 - 3 + ( 2 - 7 - 1 ) * 2 * ( 3 - 4 * ( 1 + 1 ) ) - 4",
+        "( 12 + 34 - 5 * ( 6 - 7 ) + 1000 / ( 3 + 4 ) - ( 1 - ( 2 - 3 ) ) ) * 2 / 3",
+        "7 - ( 1 - 2 - 3 ) * 2 - 1 - 1000 / 7 / 3 * 2 * 2 / ( 5 - 3 )\n1 + 1"
+    };
+
+    // small tasks make even the short expressions split into many leaves
+    for( const auto& expr : exprs )
+    {
+        calc::expression_evaluator< int64_t > e;
+        e.consume( expr.data(), expr.length() );
+        if( !e.finished() )
+        {
+            e.consume( "\n", 1 );
+        }
+
+        int64_t expected{ e.result() };
+
+        for( std::size_t min_task_size : { 1, 2, 3, 5, 8, 1 << 20 } )
+        {
+            calc::parallel_calculator< int64_t > c{ exec, min_task_size };
+            BOOST_REQUIRE( c.calculate( expr.data(), expr.length() ) == expected );
+        }
+    }
+
+    // invalid expressions are reported as by the sequential calculation
+    for( const std::string expr : { "1 + ( 2 * 3", "1 + 2 * 3 ) - 4", "1 + 2 / ( 3 - 3 ) - 4 * 5", "1 + 2 +" } )
+    {
+        calc::parallel_calculator< int64_t > c{ exec, 2 };
+        BOOST_REQUIRE_THROW( c.calculate( expr.data(), expr.length() ), std::exception );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( bracket_index_test )
+{
+    calc::executor exec{ 4 };
+
+    std::string expr{ "( 1 + ( 2 * ( 3 - 4 ) ) ) * ( 5 ) - ( ( 6 + 7 ) / ( 8 - ( 9 ) ) + 10 )" };
+    const char* begin{ expr.data() };
+    const char* end{ expr.data() + expr.length() };
+
+    // every chunking and group size gives the same matches as the plain scan
+    for( std::size_t chunk_size : { 1, 2, 3, 7, 16, 1 << 20 } )
+    {
+        for( std::size_t min_group_size : { 1, 5, 20 } )
+        {
+            calc::bracket_index index{ begin, end, min_group_size, exec, chunk_size };
+            BOOST_REQUIRE( index.valid() );
+
+            for( const char* it{ begin }; it != end; ++it )
+            {
+                if( *it != '(' )
+                {
+                    continue;
+                }
+
+                int depth{ 0 };
+                const char* closing{ it };
+                for( ; depth != 1 || *closing != ')'; ++closing )
+                {
+                    depth += *closing == '('? 1 : *closing == ')'? -1 : 0;
+                }
+
+                BOOST_REQUIRE( index.closing( it ) == closing );
+            }
+        }
+    }
+
+    for( const std::string invalid : { "( 1 + 2", "1 + 2 )", ") 1 + 2 (", "( ( 1 ) ) )" } )
+    {
+        calc::bracket_index index{ invalid.data(), invalid.data() + invalid.length(), 1, exec, 2 };
+        BOOST_REQUIRE( !index.valid() );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( hybrid_integer_test )
+{
+    using hybrid = calc::hybrid_integer< BigInteger >;
+
+    // the results crossing the machine word limits match the big integer ones
+    std::vector< std::string > exprs
+    {
+        "1 + 2 * 3 - 4 / 2\n",
+        "-7 / 2 + ( -9 ) / 4 * 3 + 8 / ( -2 )\n",
+        "9223372036854775807 + 1\n",
+        "-9223372036854775807 - 1 - 1\n",
+        "-9223372036854775807 - 1\n",
+        "( -9223372036854775807 - 1 ) / ( -1 )\n",
+        "4294967296 * 4294967296 * 4294967296 / 4294967296 / 4294967296 - 1\n",
+        "123456789012345678901234567890 - 123456789012345678901234567889 + 5\n",
+        "( 3037000500 * 3037000500 - 9223372036854775807 ) * 2 / 3\n",
+        "7 / ( 99999999999999999999 - 99999999999999999999 )\n"
+    };
+
+    for( const auto& expr : exprs )
+    {
+        calc::expression_evaluator< BigInteger > big_evaluator;
+        calc::expression_evaluator< hybrid > hybrid_evaluator;
+
+        std::string big_result;
+        std::string hybrid_result;
+
+        try
+        {
+            big_evaluator.consume( expr.data(), expr.length() );
+            big_result = boost::lexical_cast< std::string >( big_evaluator.result() );
+        }
+        catch( const std::exception& e )
+        {
+            big_result = e.what();
+        }
+
+        try
+        {
+            hybrid_evaluator.consume( expr.data(), expr.length() );
+            hybrid_result = boost::lexical_cast< std::string >( hybrid_evaluator.result() );
+        }
+        catch( const std::exception& e )
+        {
+            hybrid_result = e.what();
+        }
+
+        BOOST_REQUIRE_EQUAL( hybrid_result, big_result );
+    }
+
+    hybrid small{ 1000 };
+    small *= hybrid{ 1000 };
+    BOOST_REQUIRE( small.is_small() );
+
+    hybrid promoted{ std::numeric_limits< int64_t >::max() };
+    promoted += hybrid{ 1 };
+    BOOST_REQUIRE( !promoted.is_small() );
+    BOOST_REQUIRE( boost::lexical_cast< std::string >( promoted ) == "9223372036854775808" );
+}
+
+BOOST_AUTO_TEST_CASE( calc_handle_overflow_fallback )
+{
+    {// checked types report the overflow instead of wrapping around
+        std::map< std::string, std::string > expr_res_map
+        {
+            { "9223372036854775807 + 1\n", "Overflow" },
+            { "-9223372036854775807 - 1\n", "-9223372036854775808" },
+            { "( -9223372036854775807 - 1 ) / ( -1 )\n", "Overflow" },
+            { "3037000500 * 3037000500\n", "Overflow" },
+            { "92233720368547758070\n", "Overflow" }
+        };
+
+        for( const auto& expr_res : expr_res_map )
+        {
+            calc::calc_handle< calc::checked_int64 > h;
+            h.on_data( expr_res.first.data(), expr_res.first.length(), true );
+            BOOST_REQUIRE_EQUAL( h.get_result(), expr_res.second );
+            BOOST_REQUIRE( h.overflowed() == ( expr_res.second == "Overflow" ) );
+        }
+
+        calc::calc_handle< calc::checked_int128 > h;
+        std::string expr{ "9223372036854775807 * 9223372036854775807 - 1\n" };
+        h.on_data( expr.data(), expr.length(), true );
+        BOOST_REQUIRE_EQUAL( h.get_result(), "85070591730234615847396907784232501248" );
+    }
+
+    {// overflowing expressions are recalculated with the exact type, both inline and in parts
+        std::map< std::string, std::string > expr_res_map
+        {
+            { "1 + 2 * 3\n", "7" },
+            { "9223372036854775807 + 1 - 2\n", "9223372036854775806" },
+            { "4294967296 * 4294967296 / 4294967296\n", "4294967296" },
+            { "1 / ( 3 - 3 )\n", "Division by zero" },
+            { "-7 / 2\n", "-4" },
+            { "-7 / 2 * 9223372036854775807 / 9223372036854775807\n", "-4" }
+        };
+
+        for( const auto& expr_res : expr_res_map )
+        {
+            for( uint64_t inline_limit : { calc::default_inline_limit, uint64_t{ 0 } } )
+            {
+                calc::fallback_calc_handle< calc::floored_checked_int64, BigInteger > h{ inline_limit };
+                const std::string& expr{ expr_res.first };
+                std::size_t half{ expr.length() / 2 };
+
+                if( inline_limit )
+                {
+                    h.on_data( expr.data(), expr.length(), true );
+                }
+                else
+                {
+                    h.on_data( expr.data(), half );
+                    BOOST_REQUIRE( !h.error_occured() );
+                    h.on_data( expr.data() + half, expr.length() - half, true );
+                }
+
+                BOOST_REQUIRE_EQUAL( h.get_result(), expr_res.second );
+                BOOST_REQUIRE( h.finished() );
+            }
+        }
+
+        // the retry reads the part of the expression over the buffer size back from the spill file
+        calc::fallback_calc_handle< calc::floored_checked_int64, BigInteger > h{ 0, 0, 8 };
+        std::string expr{ "9223372036854775807 + 1 - 2 + 3 - 4\n" };
+        for( std::size_t pos{ 0 }; pos < expr.length(); pos += 5 )
+        {
+            h.on_data( expr.data() + pos, std::min< std::size_t >( 5, expr.length() - pos ), pos + 5 >= expr.length() );
+        }
+
+        BOOST_REQUIRE_EQUAL( h.get_result(), "9223372036854775805" );
+
+        // the exact calculation reads the spill file itself, even when a part is spilled whole
+        // and the expression has no trailing newline
+        for( uint64_t buffer_size : { 0, 8 } )
+        {
+            calc::fallback_calc_handle< calc::floored_checked_int64, BigInteger > spilled{ 0, 0, buffer_size };
+            std::string first{ "9223372" };
+            std::string rest{ "036854775807 + 1 - 2 + 3 - 4" };
+
+            spilled.on_data( first.data(), first.length() );
+            spilled.on_data( rest.data(), rest.length(), true );
+            BOOST_REQUIRE_EQUAL( spilled.get_result(), "9223372036854775805" );
+        }
+
+        // the checked types truncate the quotient by default
+        calc::checked_int64 quotient{ -7 };
+        quotient /= calc::checked_int64{ 2 };
+        BOOST_REQUIRE_EQUAL( quotient.value(), -3 );
+    }
+}
+
+#ifdef WITH_GMP
+BOOST_AUTO_TEST_CASE( gmp_backend )
+{
+    // the quotient is truncated towards zero like the one of the built-in integers
+    std::vector< std::string > small_exprs
+    {
+        "1 + 2 * 3 - 4 / 2\n",
+        "-7 / 2 + ( -9 ) / 4 * 3\n",
+        "9223372036854775807 * 9223372036854775807 / ( 0 - 3 )\n",
+        "7 / ( 5 - 5 )\n"
+    };
+
+    for( const auto& expr : small_exprs )
+    {
+        calc::calc_handle< calc::checked_int128 > int_handle;
+        calc::calc_handle< calc::gmp_integer > gmp_handle;
+
+        int_handle.on_data( expr.data(), expr.length(), true );
+        gmp_handle.on_data( expr.data(), expr.length(), true );
+
+        BOOST_REQUIRE_EQUAL( gmp_handle.get_result(), int_handle.get_result() );
+    }
+
+    std::vector< std::string > big_exprs
+    {
+        "123456789012345678901234567890 * 987654321098765432109876543210 / 3 - 1\n",
+        "-99999999999999999999999999 * 99999999999999999999 + 1\n",
+        "( 99999999999999999999999999 - 2 ) * ( 99999999999999999999 - 1 ) / 12345678901234567\n"
+    };
+
+    for( const auto& expr : big_exprs )
+    {
+        calc::calc_handle< BigInteger > big_handle;
+        calc::calc_handle< calc::gmp_integer > gmp_handle;
+
+        big_handle.on_data( expr.data(), expr.length(), true );
+        gmp_handle.on_data( expr.data(), expr.length(), true );
+
+        BOOST_REQUIRE_EQUAL( gmp_handle.get_result(), big_handle.get_result() );
+    }
+
+    BOOST_REQUIRE( calc::number_traits< calc::gmp_integer >::format( calc::gmp_integer{ -1000 } ) == "-1000" );
+    BOOST_REQUIRE( calc::number_traits< calc::gmp_integer >::format( calc::gmp_integer{ 0 } ) == "0" );
+}
+#endif
+
+BOOST_AUTO_TEST_CASE( decimal_backend )
+{
+    // the quotient is truncated towards zero like the one of the built-in integers
+    std::vector< std::string > small_exprs
+    {
+        "1 + 2 * 3 - 4 / 2\n",
+        "-7 / 2 + ( -9 ) / 4 * 3\n",
+        "9223372036854775807 * 9223372036854775807 / ( 0 - 3 )\n",
+        "( -9223372036854775807 - 1 ) * 3 - 9999999999999999999 + 1\n",
+        "7 / ( 5 - 5 )\n"
+    };
+
+    for( const auto& expr : small_exprs )
+    {
+        calc::calc_handle< calc::checked_int128 > int_handle;
+        calc::calc_handle< calc::decimal_integer > decimal_handle;
+
+        int_handle.on_data( expr.data(), expr.length(), true );
+        decimal_handle.on_data( expr.data(), expr.length(), true );
+
+        BOOST_REQUIRE_EQUAL( decimal_handle.get_result(), int_handle.get_result() );
+    }
+
+    // the limb boundaries and the long division agree with the bundled big integer
+    std::mt19937_64 random{ 42 };
+    auto random_number = [ & ]()
+    {
+        std::string number{ std::to_string( random() % 9 + 1 ) };
+        for( uint64_t digits{ random() % 80 }; digits; --digits )
+        {
+            number += random() % 4? static_cast< char >( '0' + random() % 10 ) : '9';
+        }
+
+        return number;
+    };
+
+    for( size_t i{ 0 }; i < 200; ++i )
+    {
+        std::string expr{ random_number() + " * " + random_number() + " / " + random_number() +
+                          " + " + random_number() + " - " + random_number() + "\n" };
+
+        calc::calc_handle< BigInteger > big_handle;
+        calc::calc_handle< calc::decimal_integer > decimal_handle;
+
+        big_handle.on_data( expr.data(), expr.length(), true );
+        decimal_handle.on_data( expr.data(), expr.length(), true );
+
+        BOOST_REQUIRE_EQUAL( decimal_handle.get_result(), big_handle.get_result() );
+    }
+
+    BOOST_REQUIRE( calc::decimal_integer::parse( "-00010000000000000000000" ).to_string() == "-10000000000000000000" );
+    BOOST_REQUIRE( calc::decimal_integer::parse( "-0" ).to_string() == "0" );
+}
+
 BOOST_AUTO_TEST_CASE( parser_abort )
 {
     calc::async_calculator< int64_t > c;
     std::future< int64_t > f;
 
-    BOOST_REQUIRE_NO_THROW( f = std::move( c.start( "1 + " ) ) )
+    BOOST_REQUIRE_NO_THROW( f = std::move( c.start( "1 + " ) ) );
     std::this_thread::sleep_for( std::chrono::milliseconds{ 100 } );
     BOOST_REQUIRE( c.running() == true );
-    BOOST_REQUIRE_NO_THROW( c.abort() )
+    BOOST_REQUIRE_NO_THROW( c.abort() );
 
-    BOOST_REQUIRE_THROW( f.get(), calc::calculation_aborted )
+    BOOST_REQUIRE_THROW( f.get(), calc::calculation_aborted );
     BOOST_REQUIRE( c.running() == false );
 }
 
@@ -140,7 +661,7 @@ BOOST_AUTO_TEST_CASE( calc_handle_test )
 
         std::string expr{ "1 + 2\n" };
 
-        BOOST_REQUIRE_NO_THROW( h.on_data( expr.data(), expr.length() ) )
+        BOOST_REQUIRE_NO_THROW( h.on_data( expr.data(), expr.length() ) );
         std::this_thread::sleep_for( std::chrono::milliseconds{ 100 } );
         verify_handle( h, 3 );
     }
@@ -148,62 +669,819 @@ BOOST_AUTO_TEST_CASE( calc_handle_test )
     {// part expr
         calc::calc_handle< int64_t > h;
         std::future< int64_t > f;
-        int64_t result{};
 
         std::string expr1{ "1 + " };
         std::string expr2{ "2\n" };
 
-        BOOST_REQUIRE_NO_THROW( h.on_data( expr1.data(), expr1.length() ) )
-        BOOST_REQUIRE_NO_THROW( h.on_data( expr2.data(), expr2.length() ) )
+        BOOST_REQUIRE_NO_THROW( h.on_data( expr1.data(), expr1.length() ) );
+        BOOST_REQUIRE_NO_THROW( h.on_data( expr2.data(), expr2.length() ) );
         std::this_thread::sleep_for( std::chrono::milliseconds{ 100 } );
         verify_handle( h, 3 );
     }
 }
 
+BOOST_AUTO_TEST_CASE( calc_handle_inline )
+{
+    {// small expression received in one piece is ready right away
+        calc::calc_handle< int64_t > h;
+        std::string expr{ "2 * ( 3 + 4 )" };
+
+        BOOST_REQUIRE_NO_THROW( h.on_data( expr.data(), expr.length(), true ) );
+        BOOST_REQUIRE( h.finished() );
+        BOOST_REQUIRE( !h.running() );
+
+        std::string result;
+        BOOST_REQUIRE_NO_THROW( h.async_get_result( [ & ]( std::string r ){ result = r; } ) );
+        BOOST_REQUIRE( result == "14" );
+    }
+
+    {
+        calc::calc_handle< int64_t > h;
+        std::string expr{ "1 / 0\n" };
+
+        BOOST_REQUIRE_NO_THROW( h.on_data( expr.data(), expr.length(), true ) );
+        BOOST_REQUIRE( h.error_occured() );
+        BOOST_REQUIRE( h.get_result() == "Division by zero" );
+    }
+
+    {// over the limit
+        calc::calc_handle< int64_t > h{ 4 };
+        std::string expr{ "2 * 21\n" };
+
+        BOOST_REQUIRE_NO_THROW( h.on_data( expr.data(), expr.length(), true ) );
+        BOOST_REQUIRE( h.get_result() == "42" );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( calc_handle_async_result )
+{
+    calc::calc_handle< int64_t > h;
+    std::promise< std::string > delivered;
+
+    std::string expr1{ "6 * " };
+    std::string expr2{ "7\n" };
+
+    // the handler is registered before the calculation is done
+    BOOST_REQUIRE_NO_THROW( h.on_data( expr1.data(), expr1.length() ) );
+    BOOST_REQUIRE_NO_THROW( h.async_get_result( [ & ]( std::string result ){ delivered.set_value( result ); } ) );
+    BOOST_REQUIRE_NO_THROW( h.on_data( expr2.data(), expr2.length() ) );
+
+    std::future< std::string > f{ delivered.get_future() };
+    BOOST_REQUIRE( f.wait_for( std::chrono::seconds{ 5 } ) == std::future_status::ready );
+    BOOST_REQUIRE( f.get() == "42" );
+
+    // and after it
+    std::string result;
+    BOOST_REQUIRE_NO_THROW( h.async_get_result( [ & ]( std::string r ){ result = r; } ) );
+    BOOST_REQUIRE( result == "42" );
+}
+
+BOOST_AUTO_TEST_CASE( progressive_format_test )
+{
+    auto collect = []( std::vector< std::string >& chunks )
+    {
+        return [ &chunks ]( std::string chunk ){ chunks.push_back( std::move( chunk ) ); };
+    };
+
+    auto joined = []( const std::vector< std::string >& chunks )
+    {
+        std::string result;
+        for( const auto& chunk : chunks )
+        {
+            result += chunk;
+        }
+
+        return result;
+    };
+
+    // the zeroes inside the number and the sign survive the halving with the tiny leaves
+    std::vector< std::string > numbers{ "0", "7", "-1", "1000000000000000000000000000000000000000000001",
+                                        "-98765432109876543210000000000000000000000000000000000000000123" };
+    for( const auto& number : numbers )
+    {
+        std::vector< std::string > chunks;
+        auto handler = collect( chunks );
+        calc::detail::halving_formatter< BigInteger, calc::detail::big_integer_leaf_traits >{ handler, 3 }.format(
+            calc::number_traits< BigInteger >::parse( number ) );
+
+        BOOST_REQUIRE_EQUAL( joined( chunks ), number );
+    }
+
+    // a big power matches the own conversion of every type
+    calc::expression_evaluator< calc::decimal_integer > evaluator;
+    std::string expr{ "0 - 3" };
+    for( int i{ 0 }; i < 3000; ++i )
+    {
+        expr += " * 7";
+    }
+
+    expr += "\n";
+    evaluator.consume( expr.data(), expr.size() );
+    std::string expected{ evaluator.result().to_string() };
+
+    {
+        std::vector< std::string > chunks;
+        calc::progressive_format< BigInteger >::format( calc::number_traits< BigInteger >::parse( expected ), collect( chunks ) );
+        BOOST_REQUIRE_EQUAL( joined( chunks ), expected );
+        BOOST_REQUIRE_EQUAL( bigIntegerToString( calc::number_traits< BigInteger >::parse( expected ) ), expected );
+    }
+
+    {
+        using hybrid = calc::hybrid_integer< BigInteger >;
+
+        std::vector< std::string > chunks;
+        calc::progressive_format< hybrid >::format( calc::number_traits< hybrid >::parse( expected ), collect( chunks ) );
+        BOOST_REQUIRE_EQUAL( joined( chunks ), expected );
+    }
+
+    {
+        // the limbs are written by the chunks of the requested size, the leading ones first
+        std::vector< std::string > chunks;
+        calc::decimal_integer::parse( expected ).to_chunks( collect( chunks ), 10 );
+        BOOST_REQUIRE( chunks.size() > 1 );
+        BOOST_REQUIRE_EQUAL( chunks.front().substr( 0, 5 ), expected.substr( 0, 5 ) );
+        BOOST_REQUIRE_EQUAL( joined( chunks ), expected );
+    }
+
+#ifdef WITH_GMP
+    {
+        std::vector< std::string > chunks;
+        calc::progressive_format< calc::gmp_integer >::format( calc::number_traits< calc::gmp_integer >::parse( expected ),
+                                                               collect( chunks ) );
+        BOOST_REQUIRE_EQUAL( joined( chunks ), expected );
+    }
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( calc_handle_result_chunks )
+{
+    calc::calc_handle< BigInteger > h{ 0 };
+    std::string expr{ "2 * 3 * 7\n" };
+
+    std::vector< std::pair< std::string, bool > > chunks;
+    std::promise< void > delivered;
+
+    BOOST_REQUIRE_NO_THROW( h.async_get_result_chunks( [ & ]( std::string chunk, bool last )
+    {
+        chunks.emplace_back( std::move( chunk ), last );
+        if( last )
+        {
+            delivered.set_value();
+        }
+    } ) );
+
+    // not started yet, the message comes whole
+    BOOST_REQUIRE( chunks.size() == 1 && chunks.front().second );
+    chunks.clear();
+    delivered = std::promise< void >{};
+
+    BOOST_REQUIRE_NO_THROW( h.on_data( expr.data(), 2 ) );
+    BOOST_REQUIRE_NO_THROW( h.async_get_result_chunks( [ & ]( std::string chunk, bool last )
+    {
+        chunks.emplace_back( std::move( chunk ), last );
+        if( last )
+        {
+            delivered.set_value();
+        }
+    } ) );
+    BOOST_REQUIRE_NO_THROW( h.on_data( expr.data() + 2, expr.size() - 2, true ) );
+
+    std::future< void > f{ delivered.get_future() };
+    BOOST_REQUIRE( f.wait_for( std::chrono::seconds{ 5 } ) == std::future_status::ready );
+
+    // the digits are followed by the empty last chunk
+    BOOST_REQUIRE_EQUAL( chunks.size(), 2 );
+    BOOST_REQUIRE( chunks[ 0 ] == std::make_pair( std::string{ "42" }, false ) );
+    BOOST_REQUIRE( chunks[ 1 ] == std::make_pair( std::string{}, true ) );
+
+    // the streamed text isn't kept by the handle
+    BOOST_REQUIRE_EQUAL( h.get_result(), "The result was passed in chunks" );
+}
+
 BOOST_AUTO_TEST_CASE( session_test_normal_data_addition )
 {
     using namespace network::detail;
 
-    BOOST_REQUIRE_THROW( mock_session{ nullptr }, std::invalid_argument )
-    auto handle = std::make_unique< mock_calc_handle >();
-    mock_calc_handle* handle_ptr{ handle.get() };
+    mock_handle_factory factory;
+    mock_handle_stats& stats = factory._stats;
 
-    mock_session s{ std::move( handle ) };
+    mock_session s{ factory };
     BOOST_REQUIRE( !s.finished() );
-    BOOST_REQUIRE_NO_THROW( s.start() )
+    BOOST_REQUIRE_NO_THROW( s.start() );
     BOOST_REQUIRE( s.reads_occured == 1 );
     BOOST_REQUIRE( !s.write_occured );
 
     std::string test{ "test" };
-    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( test.data(), test.length(), false ) )
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( test.data(), test.length(), false ) );
     BOOST_REQUIRE( s.reads_occured == 2 );
-    BOOST_REQUIRE( handle_ptr->_on_data_calls == 1 );
+    BOOST_REQUIRE( stats.on_data_calls == 1 );
     BOOST_REQUIRE( !s.write_occured );
 
-    handle_ptr->_finished = true;
-    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( test.data(), test.length(), true ) )
-    BOOST_REQUIRE( handle_ptr->_on_data_calls == 2 );
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( test.data(), test.length(), true ) );
+    BOOST_REQUIRE( stats.on_data_calls == 2 );
+    BOOST_REQUIRE( stats.results_taken == 1 );
+    BOOST_REQUIRE( !s.finished() );
+
+    BOOST_REQUIRE_NO_THROW( s.deliver_all_results() );
     BOOST_REQUIRE( s.finished() );
     BOOST_REQUIRE( s.write_occured );
-    BOOST_REQUIRE( handle_ptr->_result_taken );
+    BOOST_REQUIRE( s.written == "test\n" );
 }
 
 BOOST_AUTO_TEST_CASE( session_test_on_error )
 {
     using namespace network::detail;
 
-    auto handle = std::make_unique< mock_calc_handle >();
-    mock_calc_handle* handle_ptr{ handle.get() };
+    mock_handle_factory factory;
+    factory._stats.error_occured = true;
 
-    mock_session s{ std::move( handle ) };
-    handle_ptr->_error_occured = true;
-    handle_ptr->_finished = true;
+    mock_session s{ factory };
 
     std::string test{ "test" };
-    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( test.data(), test.length(), true ) )
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( test.data(), test.length(), true ) );
+    BOOST_REQUIRE_NO_THROW( s.deliver_all_results() );
     BOOST_REQUIRE( s.finished() );
     BOOST_REQUIRE( s.write_occured );
-    BOOST_REQUIRE( handle_ptr->_result_taken );
+    BOOST_REQUIRE( factory._stats.results_taken == 1 );
+    BOOST_REQUIRE( factory._stats.on_data_calls == 0 );
+
+    // the exception of a handle is the result of its expression, the next ones go on
+    mock_handle_factory failing_factory;
+    failing_factory._stats.throw_on_data = true;
+
+    mock_session failing_session{ failing_factory };
+
+    std::string data{ "1 + 2\n3 + 4\n" };
+    BOOST_REQUIRE_NO_THROW( failing_session.on_data_accessor( data.data(), data.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( failing_session.deliver_all_results() );
+    BOOST_REQUIRE_EQUAL( failing_session.written, "Handle failure\nHandle failure\n" );
+    BOOST_REQUIRE( failing_factory._stats.on_data_calls == 2 );
+}
+
+BOOST_AUTO_TEST_CASE( session_test_pipelining )
+{
+    using namespace network::detail;
+
+    mock_handle_factory factory;
+    mock_session s{ factory };
+    s.complete_writes = false;
+
+    // three expressions, the last one is split between the reads
+    std::string part1{ "1\n2\n3" };
+    std::string part2{ "3\n" };
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( part1.data(), part1.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( part2.data(), part2.length(), false ) );
+    BOOST_REQUIRE( factory._stats.on_data_calls == 4 );
+    BOOST_REQUIRE( s.results.size() == 3 );
+
+    // results are written in the order of the expressions
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 1 ) );
+    BOOST_REQUIRE( !s.write_occured );
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 0 ) );
+    BOOST_REQUIRE( s.writes_occured == 1 );
+    BOOST_REQUIRE( s.written == "test\ntest\n" );
+
+    // and coalesced while the previous write is in progress
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 2 ) );
+    BOOST_REQUIRE( s.writes_occured == 1 );
+    BOOST_REQUIRE_NO_THROW( s.finish_write() );
+    BOOST_REQUIRE( s.writes_occured == 2 );
+    BOOST_REQUIRE( s.written == "test\ntest\ntest\n" );
+}
+
+BOOST_AUTO_TEST_CASE( session_test_result_chunks )
+{
+    using namespace network::detail;
+
+    mock_handle_factory factory;
+    mock_session s{ factory };
+
+    std::string data{ "1\n2\n" };
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( data.data(), data.length(), false ) );
+    BOOST_REQUIRE( s.results.size() == 2 );
+
+    // the chunks of the first result are sent as they come
+    s.results.emplace( s.results.begin(), 0, "12", false );
+    s.results.emplace( s.results.begin() + 1, 0, "34", false );
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 0 ) );
+    BOOST_REQUIRE( s.written == "12" );
+
+    // the next result waits for the end of the first one
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 3 ) );
+    BOOST_REQUIRE( s.written == "12" );
+
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 1 ) );
+    BOOST_REQUIRE( s.written == "1234" );
+    BOOST_REQUIRE( !s.finished() );
+
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 2 ) );
+    BOOST_REQUIRE( s.written == "1234test\ntest\n" );
+}
+
+BOOST_AUTO_TEST_CASE( session_test_write_error )
+{
+    using namespace network::detail;
+
+    mock_handle_factory factory;
+    mock_session s{ factory };
+    s.complete_writes = false;
+
+    std::string data{ "1\n2\n" };
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( data.data(), data.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 0 ) );
+    BOOST_REQUIRE( s.writes_occured == 1 );
+
+    // nothing is written or read after the failed write, the session is done
+    BOOST_REQUIRE_NO_THROW( s.fail_write() );
+    BOOST_REQUIRE( s.finished() );
+
+    uint64_t reads{ s.reads_occured };
+    BOOST_REQUIRE_NO_THROW( s.deliver_result( 1 ) );
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( data.data(), data.length(), false ) );
+    BOOST_REQUIRE( s.writes_occured == 1 );
+    BOOST_REQUIRE( s.reads_occured == reads );
+    BOOST_REQUIRE( factory._stats.on_data_calls == 2 );
+}
+
+BOOST_AUTO_TEST_CASE( session_test_backend_selection )
+{
+    using namespace network::detail;
+
+    calc::backend_registry backends;
+    backends.add( "int64", std::make_unique< calc::calc_handle_factory< int64_t > >() );
+    backends.add( "checked", std::make_unique< calc::calc_handle_factory< calc::checked_int64 > >() );
+    BOOST_REQUIRE_THROW( backends.set_default( "unknown" ), std::invalid_argument );
+
+    mock_session s{ backends };
+
+    // the prefix selects the number type of a single expression and may be split between the reads
+    std::string part1{ "@checked 9223372036854775807 + 1\n9223372036854775807 + 1\n@che" };
+    std::string part2{ "cked 2 * 3\n@unknown 1 + 1\n@int64 5\n" };
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( part1.data(), part1.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( s.on_data_accessor( part2.data(), part2.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( s.deliver_all_results() );
+
+    BOOST_REQUIRE_EQUAL( s.written, "Overflow\n-9223372036854775808\n6\nUnknown backend: unknown\n5\n" );
+
+    // the read ends right after the prefix, the calculation starts with the next part
+    mock_session split_session{ backends };
+
+    std::string prefix{ "@int64 " };
+    std::string rest{ "1 + 2\n@checked " };
+    std::string last{ "2 * 3\n" };
+    BOOST_REQUIRE_NO_THROW( split_session.on_data_accessor( prefix.data(), prefix.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( split_session.on_data_accessor( rest.data(), rest.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( split_session.on_data_accessor( last.data(), last.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( split_session.deliver_all_results() );
+    BOOST_REQUIRE_EQUAL( split_session.written, "3\n6\n" );
+
+    backends.set_default( "checked" );
+    BOOST_REQUIRE( backends.names() == ( std::vector< std::string >{ "checked", "int64" } ) );
+    BOOST_REQUIRE_EQUAL( backends.default_backend(), "checked" );
+
+    // the servers with the different default backends don't share the results
+    calc::backend_registry wrapping;
+    wrapping.add( "int64", std::make_unique< calc::calc_handle_factory< int64_t > >() );
+
+    network::result_cache cache{ 1 << 20, 0 };
+    mock_session wrapping_session{ wrapping, &cache };
+    mock_session checked_session{ backends, &cache };
+
+    std::string overflow{ "9223372036854775807 + 1\n" };
+    BOOST_REQUIRE_NO_THROW( wrapping_session.on_data_accessor( overflow.data(), overflow.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( wrapping_session.deliver_all_results() );
+    BOOST_REQUIRE_NO_THROW( checked_session.on_data_accessor( overflow.data(), overflow.length(), false ) );
+    BOOST_REQUIRE_NO_THROW( checked_session.deliver_all_results() );
+
+    BOOST_REQUIRE_EQUAL( wrapping_session.written, "-9223372036854775808\n" );
+    BOOST_REQUIRE_EQUAL( checked_session.written, "Overflow\n" );
+}
+
+BOOST_AUTO_TEST_CASE( calc_in_memory )
+{
+    calc::backend_registry backends;
+    backends.add( "fallback", std::make_unique< calc::fallback_calc_handle_factory< calc::floored_checked_int64, BigInteger > >() );
+    backends.add( "int64", std::make_unique< calc::calc_handle_factory< calc::checked_int64 > >() );
+
+    // up to the first newline, the overflowed expressions are recalculated with the exact type
+    std::string text{ "9223372036854775807 + 1\n1 + 2\n" };
+    BOOST_REQUIRE_EQUAL( backends.calculate( text.data(), text.length() ), "9223372036854775808" );
+    BOOST_REQUIRE_EQUAL( backends.calculate( text.data() + 24, text.length() - 24 ), "3" );
+
+    backends.set_default( "int64" );
+    BOOST_REQUIRE_EQUAL( backends.calculate( text.data(), text.length() ), "Overflow" );
+
+    std::string invalid{ "1 / ( 2 - 2 )" };
+    BOOST_REQUIRE_EQUAL( backends.calculate( invalid.data(), invalid.length() ), "Division by zero" );
+
+    // the factories without the in place calculation go through a handle
+    mock_handle_factory factory;
+    BOOST_REQUIRE_EQUAL( factory.calculate( text.data(), text.length() ), "test" );
+}
+
+BOOST_AUTO_TEST_CASE( batch_calculator_test )
+{
+    std::string directory{ "/tmp/calc_batch_test_" + std::to_string( ::getpid() ) };
+    BOOST_REQUIRE_EQUAL( std::system( ( "mkdir -p " + directory + "/sub" ).c_str() ), 0 );
+
+    std::map< std::string, std::string > files
+    {
+        { "/a.txt", "1 + 2\n" },
+        { "/b.txt", "( 1 + 2 ) * 3\n\n4 / 2\n" },
+        { "/c.expr", "10 / 0\n" }
+    };
+
+    for( const auto& file : files )
+    {
+        std::ofstream{ directory + file.first } << file.second;
+    }
+
+    // the subdirectories are skipped
+    BOOST_REQUIRE_EQUAL( calc::batch_calculator::find_files( directory ).size(), 3 );
+    BOOST_REQUIRE_EQUAL( calc::batch_calculator::find_files( directory + "/*.txt" ).size(), 2 );
+    BOOST_REQUIRE( calc::batch_calculator::find_files( directory + "/*.none" ).empty() );
+
+    // one thread takes the files from the biggest one
+    calc::calc_handle_factory< int64_t > factory;
+    calc::batch_calculator batch{ factory, 1 };
+    std::ostringstream out;
+    batch.calculate( calc::batch_calculator::find_files( directory ), out );
+
+    std::istringstream lines{ out.str() };
+    std::vector< std::string > expected{ directory + "/b.txt\t21\t", "9 2",
+                                         directory + "/c.expr\t7\t", "Division by zero",
+                                         directory + "/a.txt\t6\t", "3" };
+
+    for( std::size_t i{ 0 }; i < expected.size(); i += 2 )
+    {
+        std::string line;
+        BOOST_REQUIRE( std::getline( lines, line ) );
+        BOOST_REQUIRE_EQUAL( line.substr( 0, expected[ i ].length() ), expected[ i ] );
+        BOOST_REQUIRE_EQUAL( line.substr( line.rfind( '\t' ) + 1 ), expected[ i + 1 ] );
+    }
+
+    BOOST_REQUIRE_EQUAL( std::system( ( "rm -rf " + directory ).c_str() ), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( result_cache_test )
+{
+    using namespace network;
+
+    // the key doesn't depend on how the text is split
+    std::string text{ "( 123 + 456 ) * 789 - 1011 / 1213\n" };
+    content_hash whole;
+    whole.update( text.data(), text.length() );
+
+    for( size_t part_size : { 1, 3, 7, 9 } )
+    {
+        content_hash parts;
+        for( size_t pos{ 0 }; pos < text.length(); pos += part_size )
+        {
+            parts.update( text.data() + pos, std::min( part_size, text.length() - pos ) );
+        }
+
+        BOOST_REQUIRE( parts.digest() == whole.digest() );
+    }
+
+    content_hash other;
+    other.update( text.data(), text.length() - 1 );
+    BOOST_REQUIRE( !( other.digest() == whole.digest() ) );
+
+    // SHA-256 of "abc" and of the 56 bytes that need the second padding block
+    content_hash abc;
+    abc.update( "abc", 3 );
+    BOOST_REQUIRE( ( abc.digest().digest == std::array< uint64_t, 4 >{ { 0xba7816bf8f01cfea, 0x414140de5dae2223,
+                                                                         0xb00361a396177a9c, 0xb410ff61f20015ad } } ) );
+
+    std::string two_blocks{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq" };
+    content_hash padded;
+    padded.update( two_blocks.data(), two_blocks.length() );
+    BOOST_REQUIRE( ( padded.digest().digest == std::array< uint64_t, 4 >{ { 0x248d6a61d20638b8, 0xe5c026930c3e6039,
+                                                                            0xa33ce45964ff2167, 0xf6ecedd419db06c1 } } ) );
+
+    // the same hash of a text of another length isn't taken for it
+    content_key longer{ whole.digest() };
+    ++longer.size;
+    BOOST_REQUIRE( !( longer == whole.digest() ) );
+
+    // the first request calculates, the identical ones wait for it
+    result_cache cache{ 240, 0 };
+    std::vector< std::string > results;
+    auto handler = [ &results ]( std::string result, bool found )
+    {
+        BOOST_REQUIRE( found );
+        results.push_back( std::move( result ) );
+    };
+
+    content_key key{ whole.digest() };
+    BOOST_REQUIRE( !cache.find_or_wait( key, handler ) );
+    BOOST_REQUIRE( cache.find_or_wait( key, handler ) );
+    BOOST_REQUIRE( results.empty() );
+
+    cache.complete( key, "42", true );
+    BOOST_REQUIRE( results == std::vector< std::string >{ "42" } );
+    BOOST_REQUIRE( cache.find_or_wait( key, handler ) );
+    BOOST_REQUIRE( results.size() == 2 && results.back() == "42" );
+
+    // the errors aren't cached, the waiting requests are released to calculate it themselves
+    content_key failed{ other.digest() };
+    int released{ 0 };
+    BOOST_REQUIRE( !cache.find_or_wait( failed, handler ) );
+    BOOST_REQUIRE( cache.find_or_wait( failed, [ &released ]( std::string result, bool found )
+    {
+        released += !found && result.empty()? 1 : 0;
+    } ) );
+    cache.complete( failed, "Calculation aborted", false );
+    BOOST_REQUIRE_EQUAL( released, 1 );
+
+    // the least recently used results are dropped beyond the budget
+    BOOST_REQUIRE( !cache.find_or_wait( failed, handler ) );
+    cache.complete( failed, std::string( 150, '1' ), true );
+
+    BOOST_REQUIRE( cache.find_or_wait( failed, handler ) );
+    BOOST_REQUIRE( !cache.find_or_wait( key, handler ) );
+}
+
+BOOST_AUTO_TEST_CASE( disk_result_store_test )
+{
+    using namespace network;
+
+    std::string directory{ "/tmp/calc_store_test_" + std::to_string( ::getpid() ) };
+    std::vector< std::string > numbers{ "0", "-7", "12345678901234567890123456789012345678901",
+                                        "-10000000000000000000000000000000000000", "9999999999999999999" };
+
+    auto key_of = []( uint64_t i ){ content_key key; key.digest[ 0 ] = i; key.digest[ 3 ] = ~i; return key; };
+
+    {
+        disk_result_store store{ directory };
+        for( uint64_t i{ 0 }; i < numbers.size(); ++i )
+        {
+            store.save( key_of( i ), numbers[ i ] );
+        }
+
+        // only the integers are stored
+        std::string result;
+        store.save( key_of( 100 ), "Division by zero" );
+        BOOST_REQUIRE( !store.load( key_of( 100 ), result ) );
+    }
+
+    // the results survive the restart
+    {
+        disk_result_store store{ directory };
+        std::string result;
+        for( uint64_t i{ 0 }; i < numbers.size(); ++i )
+        {
+            BOOST_REQUIRE( store.load( key_of( i ), result ) );
+            BOOST_REQUIRE_EQUAL( result, numbers[ i ] );
+        }
+
+        // the cache looks up the store before the calculation
+        result_cache cache{ 1 << 20, 0, &store };
+        std::vector< std::string > results;
+        BOOST_REQUIRE( cache.find_or_wait( key_of( 2 ), [ &results ]( std::string r, bool ){ results.push_back( r ); } ) );
+        BOOST_REQUIRE( results == std::vector< std::string >{ numbers[ 2 ] } );
+
+        BOOST_REQUIRE( !cache.find_or_wait( key_of( 200 ), []( std::string, bool ){} ) );
+        cache.complete( key_of( 200 ), "-42", true );
+        BOOST_REQUIRE( store.load( key_of( 200 ), result ) && result == "-42" );
+    }
+
+    // a file under the name of another expression isn't taken for its result
+    std::string name_of_0{ directory + "/" + std::string( 15, '0' ) + "0" + std::string( 32, '0' ) +
+                           std::string( 16, 'f' ) + std::string( 16, '0' ) + ".res" };
+    std::string name_of_9{ directory + "/" + std::string( 15, '0' ) + "9" + std::string( 32, '0' ) +
+                           std::string( 15, 'f' ) + "6" + std::string( 16, '0' ) + ".res" };
+    BOOST_REQUIRE_EQUAL( std::system( ( "cp " + name_of_0 + " " + name_of_9 ).c_str() ), 0 );
+    {
+        disk_result_store store{ directory };
+        std::string result;
+        BOOST_REQUIRE( !store.load( key_of( 9 ), result ) );
+        BOOST_REQUIRE( store.load( key_of( 0 ), result ) && result == numbers[ 0 ] );
+    }
+
+    // the least recently used results are removed beyond the size limit, a one limb result takes 64 bytes
+    BOOST_REQUIRE_EQUAL( std::system( ( "rm -rf " + directory ).c_str() ), 0 );
+    {
+        disk_result_store store{ directory, 200 };
+        std::string result;
+        for( uint64_t i{ 0 }; i < 3; ++i )
+        {
+            store.save( key_of( i ), std::to_string( i + 1 ) );
+        }
+
+        BOOST_REQUIRE( store.load( key_of( 0 ), result ) && result == "1" );
+        store.save( key_of( 3 ), "4" );
+
+        BOOST_REQUIRE( !store.load( key_of( 1 ), result ) );
+        BOOST_REQUIRE( store.load( key_of( 0 ), result ) );
+        BOOST_REQUIRE( store.load( key_of( 2 ), result ) );
+        BOOST_REQUIRE( store.load( key_of( 3 ), result ) );
+    }
+
+    // the files over the limit are removed on the start
+    {
+        disk_result_store store{ directory, 130 };
+        std::string result;
+        uint64_t loaded{ 0 };
+        for( uint64_t i{ 0 }; i < 4; ++i )
+        {
+            loaded += store.load( key_of( i ), result );
+        }
+
+        BOOST_REQUIRE_EQUAL( loaded, 2 );
+    }
+
+    BOOST_REQUIRE_EQUAL( std::system( ( "rm -rf " + directory ).c_str() ), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( session_test_result_cache )
+{
+    mock_handle_factory factory;
+    network::result_cache cache{ 1 << 20, 8 };
+
+    mock_session first{ factory, &cache };
+    mock_session second{ factory, &cache };
+
+    std::string expr{ "1 + 2 * 3 - 4\n" };
+    BOOST_REQUIRE_NO_THROW( first.on_data_accessor( expr.data(), expr.length(), false ) );
+    BOOST_REQUIRE( factory._stats.results_taken == 1 );
+
+    // the same text split differently gets the cached result, the own result isn't taken
+    BOOST_REQUIRE_NO_THROW( second.on_data_accessor( expr.data(), 5, false ) );
+    BOOST_REQUIRE_NO_THROW( second.on_data_accessor( expr.data() + 5, expr.length() - 5, false ) );
+    BOOST_REQUIRE( factory._stats.on_data_calls == 3 );
+    BOOST_REQUIRE( factory._stats.results_taken == 1 );
+
+    // the short expressions are always calculated
+    std::string short_expr{ "1 + 2\n" };
+    BOOST_REQUIRE_NO_THROW( second.on_data_accessor( short_expr.data(), short_expr.length(), false ) );
+    BOOST_REQUIRE( factory._stats.results_taken == 2 );
+
+    BOOST_REQUIRE_NO_THROW( first.deliver_all_results() );
+    BOOST_REQUIRE_NO_THROW( second.deliver_all_results() );
+    BOOST_REQUIRE_EQUAL( first.written, "test\n" );
+    BOOST_REQUIRE_EQUAL( second.written, "test\ntest\n" );
+
+    // the expression waiting for an aborted calculation gets its own result
+    std::string waiting_expr{ "5 * 6 + 7 - 8\n" };
+    network::content_hash hash;
+    hash.update( waiting_expr.data(), waiting_expr.length() );
+    BOOST_REQUIRE( !cache.find_or_wait( hash.digest(), []( std::string, bool ){} ) );
+
+    mock_session third{ factory, &cache };
+    BOOST_REQUIRE_NO_THROW( third.on_data_accessor( waiting_expr.data(), waiting_expr.length(), false ) );
+    BOOST_REQUIRE( factory._stats.results_taken == 2 );
+
+    cache.complete( hash.digest(), "Calculation aborted", false );
+    BOOST_REQUIRE_NO_THROW( third.deliver_all_results() );
+    BOOST_REQUIRE( factory._stats.results_taken == 3 );
+    BOOST_REQUIRE_EQUAL( third.written, "test\n" );
+}
+
+BOOST_AUTO_TEST_CASE( session_test_backpressure )
+{
+    mock_handle_factory factory;
+    mock_session session{ factory, nullptr, 16 };
+
+    // the reading goes on up to the high watermark
+    std::string part{ "1 + 2 + 3 + " };
+    BOOST_REQUIRE_NO_THROW( session.on_data_accessor( part.data(), part.length(), false ) );
+    BOOST_REQUIRE( factory._stats.limiter != nullptr );
+    BOOST_REQUIRE_EQUAL( session.reads_occured, 1 );
+
+    BOOST_REQUIRE_NO_THROW( session.on_data_accessor( part.data(), part.length(), false ) );
+    BOOST_REQUIRE_EQUAL( session.reads_occured, 1 );
+
+    // resumed once the calculation has consumed the data down to the low watermark
+    factory._stats.limiter->release( 12 );
+    BOOST_REQUIRE_EQUAL( session.resumes_occured, 0 );
+    factory._stats.limiter->release( 4 );
+    BOOST_REQUIRE_EQUAL( session.resumes_occured, 1 );
+    BOOST_REQUIRE_EQUAL( session.reads_occured, 2 );
+
+    factory._stats.limiter->release( 8 );
+    BOOST_REQUIRE_EQUAL( session.resumes_occured, 1 );
+
+    // the calculator releases all the data it has queued
+    calc::ingest_limiter limiter{ 1 };
+    calc::async_calculator< int64_t > c;
+    c.set_ingest_limiter( &limiter );
+
+    std::future< int64_t > f{ c.start( "1 + 2 " ) };
+    for( int i{ 0 }; i < 100; ++i )
+    {
+        c.add_expr_part( "+ 3 " );
+    }
+
+    c.add_expr_part( "\n" );
+    BOOST_REQUIRE_EQUAL( f.get(), 303 );
+    BOOST_REQUIRE_EQUAL( limiter.buffered(), 0 );
+
+    // the parts left unconsumed by the aborted calculation too
+    f = c.start( "1 + 2 " );
+    for( int i{ 0 }; i < 100; ++i )
+    {
+        c.add_expr_part( "+ 3 " );
+    }
+
+    c.abort();
+    BOOST_REQUIRE_THROW( f.get(), calc::calculation_aborted );
+    BOOST_REQUIRE_EQUAL( limiter.buffered(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( calc_spill_to_disk )
+{
+    // the calculation can't start until the worker is released, so the parts pile up
+    calc::executor exec{ 1 };
+    std::promise< void > release;
+    std::shared_future< void > released{ release.get_future() };
+    exec.post( [ released ](){ released.wait(); } );
+
+    calc::ingest_limiter limiter{ 16, 0, "/tmp" };
+    calc::async_calculator< int64_t > c{ exec };
+    c.set_ingest_limiter( &limiter );
+
+    std::future< int64_t > f{ c.start( "( 1 + 2 ) " ) };
+    for( int i{ 0 }; i < 10000; ++i )
+    {
+        c.add_expr_part( "+ 3 " );
+    }
+
+    c.add_expr_part( "\n" );
+
+    // only the data up to the high watermark is kept in memory
+    BOOST_REQUIRE( limiter.buffered() <= 16 );
+    release.set_value();
+
+    BOOST_REQUIRE_EQUAL( f.get(), 30003 );
+    BOOST_REQUIRE_EQUAL( limiter.buffered(), 0 );
+
+    // the spilling stops once the file is read out
+    f = c.start( "1 + 2\n" );
+    BOOST_REQUIRE_EQUAL( f.get(), 3 );
+
+    // the end of the expression may come in a file written by the caller
+    std::unique_ptr< calc::spill_file > spill{ new calc::spill_file{ "/tmp" } };
+    spill->append( "* 4 - ", 6 );
+    spill->append( "5\n", 2 );
+
+    f = c.start( "( 2 + 3 ) " );
+    c.add_spilled_parts( std::move( spill ) );
+    BOOST_REQUIRE_EQUAL( f.get(), 15 );
+}
+
+BOOST_AUTO_TEST_CASE( result_writer_test )
+{
+    using network::detail::result_writer;
+
+    auto take = []( result_writer& writer )
+    {
+        std::string data;
+        for( const auto& buffer : writer.next_buffers() )
+        {
+            data.append( boost::asio::buffer_cast< const char* >( buffer ), boost::asio::buffer_size( buffer ) );
+        }
+
+        writer.write_complete();
+        return data;
+    };
+
+    // the small results are sent together without copying
+    result_writer writer;
+    std::string big( 5 << 20, '7' );
+    writer.add( "1" );
+    writer.add( "-2" );
+    BOOST_REQUIRE_EQUAL( writer.next_buffers().size(), 4 );
+    BOOST_REQUIRE_EQUAL( take( writer ), "1\n-2\n" );
+    BOOST_REQUIRE( writer.empty() );
+
+    // the big ones are split into the writes of the limited size
+    writer.add( big );
+    writer.add( "3" );
+
+    std::string sent;
+    std::size_t writes{ 0 };
+    while( !writer.empty() )
+    {
+        std::string chunk{ take( writer ) };
+        BOOST_REQUIRE( chunk.size() <= network::detail::default_max_write_size );
+
+        sent += chunk;
+        ++writes;
+    }
+
+    BOOST_REQUIRE_EQUAL( writes, 6 );
+    BOOST_REQUIRE( sent == big + "\n3\n" );
+
+    // the newline may be left alone for the next write
+    result_writer small_writer{ 4 };
+    small_writer.add( "1234" );
+    small_writer.add( "" );
+    small_writer.add( "56" );
+    BOOST_REQUIRE_EQUAL( take( small_writer ), "1234" );
+    BOOST_REQUIRE_EQUAL( take( small_writer ), "\n\n56" );
+    BOOST_REQUIRE_EQUAL( take( small_writer ), "\n" );
+    BOOST_REQUIRE( small_writer.empty() );
 }
 
 BOOST_AUTO_TEST_CASE( server_test )
@@ -212,7 +1490,9 @@ BOOST_AUTO_TEST_CASE( server_test )
 
     boost::asio::io_service s;
     mock_handle_factory factory;
-    test_server server{ factory, s, 1 };
+    network::server_settings settings;
+    settings.max_sessions = 1;
+    test_server server{ factory, s, settings };
 
     auto& running_sessions = server.get_running_sessions();
     auto& waiting_session = server.get_waiting_session();
@@ -225,23 +1505,90 @@ BOOST_AUTO_TEST_CASE( server_test )
 
     // test handle_connection()
     boost::system::error_code e{};
-    BOOST_REQUIRE_NO_THROW( server.handle_connection_accessor( waiting_session, e ) )
+    BOOST_REQUIRE_NO_THROW( server.handle_connection_accessor( waiting_session, e ) );
     BOOST_REQUIRE( server._accept_next_connection_called == 2 );
     BOOST_REQUIRE( waiting_session != nullptr );
     BOOST_REQUIRE( running_sessions.size() == 1 );
 
     // test max connections logic
-    BOOST_REQUIRE_NO_THROW( server.handle_connection_accessor( waiting_session, e ) )
+    BOOST_REQUIRE_NO_THROW( server.handle_connection_accessor( waiting_session, e ) );
     BOOST_REQUIRE( running_sessions.size() == 1 );
 
     // test session removal
     std::string test{ "test" };
     auto test_session = std::dynamic_pointer_cast< mock_session >( running_sessions.back() );
-    BOOST_REQUIRE_NO_THROW( test_session->on_data_accessor( test.data(), test.length(), true ) )
+    BOOST_REQUIRE_NO_THROW( test_session->on_data_accessor( test.data(), test.length(), true ) );
+    BOOST_REQUIRE_NO_THROW( test_session->deliver_all_results() );
     BOOST_REQUIRE( test_session->finished() );
 
-    BOOST_REQUIRE_NO_THROW( server.handle_connection_accessor( waiting_session, e ) )
+    BOOST_REQUIRE_NO_THROW( server.handle_connection_accessor( waiting_session, e ) );
     BOOST_REQUIRE( server.get_running_sessions().size() == 1 );
+
+    // the io service runs on io_threads threads regardless of the connection limit:
+    // two handlers waiting for each other complete only if they run concurrently
+    boost::asio::io_service io_service;
+    settings.io_threads = 2;
+    test_server threaded_server{ factory, io_service, settings };
+
+    std::atomic< int > arrived{ 0 };
+    std::atomic< int > met{ 0 };
+    for( int i{ 0 }; i < 2; ++i )
+    {
+        io_service.post( [ & ]()
+        {
+            ++arrived;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 5 };
+            while( arrived < 2 && std::chrono::steady_clock::now() < deadline )
+            {
+                std::this_thread::yield();
+            }
+
+            met += arrived == 2? 1 : 0;
+        } );
+    }
+
+    BOOST_REQUIRE_NO_THROW( threaded_server.start() );
+    BOOST_REQUIRE_EQUAL( met, 2 );
+}
+
+BOOST_AUTO_TEST_CASE( reuse_port_server_test )
+{
+    namespace ba = boost::asio;
+
+    // every io thread listens to the same port with its own acceptor
+    ba::io_service io_service;
+    calc::calc_handle_factory< int64_t > factory;
+    uint16_t port{ 47613 };
+    network::server_settings settings;
+    settings.port = port;
+    settings.max_sessions = 8;
+    settings.io_threads = 2;
+    network::reuse_port_calc_server server{ factory, io_service, settings };
+
+    std::thread server_thread{ [ & ](){ server.start(); } };
+    BOOST_REQUIRE( server.running() );
+
+    for( int i{ 0 }; i < 4; ++i )
+    {
+        ba::io_service client_service;
+        ba::ip::tcp::socket client{ client_service };
+        client.connect( ba::ip::tcp::endpoint{ ba::ip::address_v4::loopback(), port } );
+
+        std::string expr{ std::to_string( i ) + " * 2 + 1\n" };
+        ba::write( client, ba::buffer( expr ) );
+
+        ba::streambuf response;
+        ba::read_until( client, response, '\n' );
+
+        std::string result;
+        std::istream{ &response } >> result;
+        BOOST_REQUIRE_EQUAL( result, std::to_string( i * 2 + 1 ) );
+    }
+
+    server.stop();
+    io_service.stop();
+    server_thread.join();
+    BOOST_REQUIRE( !server.running() );
 }
 
 bool is_negative_num( const std::string& expr, size_t pos )
@@ -350,10 +1697,10 @@ BOOST_AUTO_TEST_CASE( generator_test )
     std::string dest_file{ "dest" };
     uint64_t size{ 100 };
 
-    BOOST_REQUIRE_THROW( generate_expression( "", size ), std::ios_base::failure )
-    BOOST_REQUIRE_THROW( generate_expression( "dest", 2 ), std::invalid_argument )
+    BOOST_REQUIRE_THROW( generate_expression( "", size ), std::ios_base::failure );
+    BOOST_REQUIRE_THROW( generate_expression( "dest", 2 ), std::invalid_argument );
 
-    BOOST_REQUIRE_NO_THROW( generate_expression( dest_file, size ) )
+    BOOST_REQUIRE_NO_THROW( generate_expression( dest_file, size ) );
 
     std::ifstream in{ dest_file, std::ifstream::ate };
     BOOST_REQUIRE( in.is_open() );
@@ -366,7 +1713,7 @@ BOOST_AUTO_TEST_CASE( generator_test )
     for( size_t i{ 0 }; i < str.length(); ++i )
     {
         bool valid{ false };
-        BOOST_REQUIRE_NO_THROW( valid = character_valid( str, i ) )
+        BOOST_REQUIRE_NO_THROW( valid = character_valid( str, i ) );
         BOOST_REQUIRE( valid );
     }
 }